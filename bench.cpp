@@ -0,0 +1,206 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+// Replays a recorded run (see bench.py --record and parser::parse_replay) in-process, writing the same
+// CSV columns as bench.py. Times are fractional milliseconds.
+
+#include "parser.hpp"
+#include "tree-update.hpp"
+#include "string_label.h"
+
+#include "touzet-dynamic.hpp"
+#include "touzet_depth_pruning_truncated_tree_fix_tree_index.h"
+#include "touzet_kr_set_tree_index.h"
+
+#include "unit_cost_model.h"
+#include "tree_indexer.h"
+#include "label_dictionary.h"
+
+#include <cstddef>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// times a single call, in fractional milliseconds
+template <typename F>
+double time_millis(F&& f) {
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    auto stop = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(stop - start).count();
+}
+
+int main(int argc, char* argv[]) {
+
+    label::LabelDictionary<label::StringLabel> labels;
+    cost_model::UnitCostModelLD<label::StringLabel> model(labels);
+
+    ted::TouzetKRSetTreeIndex<cost_model::UnitCostModelLD<label::StringLabel>, node::TreeIndexAll> topdiff(model);
+    ted::TouzetDepthPruningTruncatedTreeFixTreeIndex<cost_model::UnitCostModelLD<label::StringLabel>, update::TreeIndexIncremental> touzet(model);
+    ted::DynamicTozuetTreeIndex<cost_model::UnitCostModelLD<label::StringLabel>, update::TreeIndexIncremental> dynamic_ted(model);
+
+    std::string replay_path, csv_path, instrumentation_path;
+
+    for (int arg = 1; arg < argc; ++arg) {
+        if (std::string(argv[arg]) == "--adaptive-bound") dynamic_ted.adaptive_bound = true;
+        else if (std::string(argv[arg]) == "--prune-retained") dynamic_ted.prune_retained = true;
+        else if (std::string(argv[arg]) == "--extend-band") dynamic_ted.extend_band = true;
+        else if (std::string(argv[arg]) == "--hash-subtrees") dynamic_ted.hash_subtrees = true;
+        else if (std::string(argv[arg]) == "--lazy") dynamic_ted.lazy = true;
+        else if (std::string(argv[arg]) == "--threads" && arg + 1 < argc) dynamic_ted.threads = std::stoi(argv[++arg]);
+        else if (std::string(argv[arg]) == "--threshold" && arg + 1 < argc) dynamic_ted.threshold = std::stod(argv[++arg]);
+        else if (std::string(argv[arg]) == "--instrumentation" && arg + 1 < argc) instrumentation_path = argv[++arg];
+        else if (replay_path.empty()) replay_path = argv[arg];
+        else if (csv_path.empty()) csv_path = argv[arg];
+        else {
+            std::cerr << "Unknown argument: " << argv[arg] << std::endl;
+            return 1;
+        }
+    }
+
+    if (csv_path.empty()) {
+        std::cerr << "Usage: " << argv[0] << " <replay path> <output path> [--adaptive-bound] [--prune-retained] [--extend-band] [--hash-subtrees] [--lazy] [--threads N] [--threshold T] [--instrumentation <path>]" << std::endl;
+        return 1;
+    }
+
+    if (!instrumentation_path.empty() && !ted::instrumented) {
+        std::cerr << "--instrumentation needs a build with TED_INSTRUMENT (make INSTRUMENT=1)" << std::endl;
+        return 1;
+    }
+
+    parser::MappedFile file(replay_path);
+    const auto replay = parser::parse_replay(file.view());
+
+    parser::LabelInterner<label::StringLabel> interner(labels);
+
+    auto read_tree = [&](std::string_view source, update::TreeIndexIncremental& t) {
+        update::IndexBuilder builder(t);
+        parser::parse_into(source, builder, interner);
+    };
+
+    auto read_revision = [&](std::string_view script, const update::TreeIndexIncremental& t_old, update::TreeIndexIncremental& t_new) {
+        return update::apply(t_old, t_new, parser::parse_edits<label::StringLabel>(script, t_old.tree_size_), labels);
+    };
+
+    // TopDiff needs the KR sets only node::index_tree computes, so it gets each step's trees rebuilt and
+    // reindexed, outside of its timings
+    auto reindex = [&](const update::TreeIndexIncremental& t, node::TreeIndexAll& t_all) {
+        update::NodeBuilder<label::StringLabel> builder(labels);
+        update::build(t, builder, std::vector<update::Edit<label::StringLabel>>(), labels);
+        node::index_tree(t_all, builder.tree(), labels, model);
+    };
+
+    // each tree's current revision, and the storage its next one is read into
+    update::TreeIndexIncremental t1_old, t2_old, t1_new, t2_new;
+    node::TreeIndexAll t1_all, t2_all;
+
+    read_tree(replay.t1, t1_old);
+    read_tree(replay.t2, t2_old);
+
+    std::cerr << "Baseline: " << dynamic_ted.ted(t1_old, t2_old) << " " << dynamic_ted.get_subproblem_count() << " " << dynamic_ted.ted_millis << std::endl;
+
+    std::ofstream csv(csv_path);
+    std::ofstream instrumentation;
+    if (!instrumentation_path.empty()) instrumentation.open(instrumentation_path);
+
+    // Dynamic-Subproblems counts the banded forest cells ForestDistance computes, which isn't the count of the
+    // library's tree_dist that the Touzet columns report
+    csv << "Edit-Distance,Dynamic-Subproblems,Dynamic-Time,Dynamic-Hit,Dynamic-Missed,Dynamic-Initial-K,Dynamic-Final-K,"
+        << "Bounded-TopDiff-Subproblems,Bounded-TopDiff-Time,Bounded-Touzet-Subproblems,Bounded-Touzet-Time,"
+        << "Bound-Finding-TopDiff-Subproblems,Bound-Finding-TopDiff-Time,Bound-Finding-Touzet-Subproblems,Bound-Finding-Touzet-Time,"
+        << "Tree1-Delta,Tree1-Subproblems,Tree1-Time,Tree2-Delta,Tree2-Subproblems,Tree2-Time\n";
+
+    for (size_t step = 0; step < replay.steps.size(); ++step) {
+
+        const auto& [t1_script, t2_script] = replay.steps[step];
+
+        std::unordered_map<size_t, size_t> t1_preserved_nodes, t2_preserved_nodes;
+
+        if (t1_script.has_value()) t1_preserved_nodes = read_revision(t1_script.value(), t1_old, t1_new);
+        if (t2_script.has_value()) t2_preserved_nodes = read_revision(t2_script.value(), t2_old, t2_new);
+
+        double answer; // the distance, or under --threshold only if it's within it
+
+        if (t1_script.has_value() && t2_script.has_value()) {
+            answer = dynamic_ted.ted(t1_old, t1_new, t1_preserved_nodes, t2_old, t2_new, t2_preserved_nodes);
+            std::swap(t1_old, t1_new);
+            std::swap(t2_old, t2_new);
+        }
+        else if (t1_script.has_value()) {
+            answer = dynamic_ted.ted(t1_old, t1_new, t1_preserved_nodes, t2_old);
+            std::swap(t1_old, t1_new);
+        }
+        else if (t2_script.has_value()) {
+            answer = dynamic_ted.ted(t1_old, t2_old, t2_new, t2_preserved_nodes);
+            std::swap(t2_old, t2_new);
+        }
+        else continue;
+
+        double distance;
+
+        reindex(t1_old, t1_all);
+        reindex(t2_old, t2_all);
+
+        const double b_topdiff_millis = time_millis([&] { distance = topdiff.ted_k(t1_all, t2_all, dynamic_ted.k_old_); });
+        const auto b_topdiff_problems = topdiff.get_subproblem_count();
+
+        const double b_touzet_millis = time_millis([&] { distance = touzet.ted_k(t1_old, t2_old, dynamic_ted.k_old_); });
+        const auto b_touzet_problems = touzet.get_subproblem_count();
+
+        const double bf_topdiff_millis = time_millis([&] { distance = topdiff.ted(t1_all, t2_all); });
+        const auto bf_topdiff_problems = topdiff.get_subproblem_count();
+
+        const double bf_touzet_millis = time_millis([&] { distance = touzet.ted(t1_old, t2_old); });
+        const auto bf_touzet_problems = touzet.get_subproblem_count();
+
+        if (distance > dynamic_ted.threshold) distance = std::numeric_limits<double>::infinity();
+
+        if (answer != distance) {
+            // should not happen - used for sanity testing during development
+            std::cerr << "Distance mismatch at step " << step << ": got " << answer << ", wanted " << distance << std::endl;
+            return 1;
+        }
+
+        csv << answer << "," << dynamic_ted.get_subproblem_count() << "," << dynamic_ted.ted_millis << ","
+            << dynamic_ted.hit << "," << dynamic_ted.missed << "," << dynamic_ted.k_initial_ << "," << dynamic_ted.k_old_ << ","
+            << b_topdiff_problems << "," << b_topdiff_millis << "," << b_touzet_problems << "," << b_touzet_millis << ","
+            << bf_topdiff_problems << "," << bf_topdiff_millis << "," << bf_touzet_problems << "," << bf_touzet_millis << ","
+            << dynamic_ted.t1_d_ << "," << dynamic_ted.t1_prep_problems << "," << dynamic_ted.t1_prep_millis << ","
+            << dynamic_ted.t2_d_ << "," << dynamic_ted.t2_prep_problems << "," << dynamic_ted.t2_prep_millis << "\n";
+
+        if (instrumentation.is_open()) {
+            instrumentation << "{\"step\": " << step + 1 << ", ";
+            dynamic_ted.instrumentation.write(instrumentation);
+            instrumentation << "}\n";
+        }
+
+        std::cerr << "Step " << step + 1 << " / " << replay.steps.size() << ": " << answer << std::endl;
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -28,6 +28,8 @@ import sys
 from typing import Optional, Union, List
 import csv
 import itertools
+import struct
+import mmap
 import sys
 
 # TODO: actually swap to class-based nodes with .version, .index, .label, .children
@@ -63,7 +65,14 @@ class Node:
         return node
 
     def remove(self, label):
-        self.children.pop(bisect.bisect_left(self.children, label))
+        return self.children.pop(bisect.bisect_left(self.children, label))
+
+    def encode(self):
+        # preorder (size, label) records, as read by parser::parse_edits
+        label = self.label.encode()
+        children = [child.encode() for child in self.children]
+        size = 1 + sum(struct.unpack_from("<I", child)[0] for child in children)
+        return struct.pack("<II", size, len(label)) + label + b"".join(children)
 
     def __lt__(self, obj):
         if isinstance(obj, str):
@@ -93,6 +102,8 @@ class Node:
 class Tree:
     def __init__(self):
         self.root = Node(os.path.sep)
+        self.inserted = []  # (parent, node) for every new subtree hung under an indexed node
+        self.removed = []  # indices of removed nodes
 
     def getByPath(self, path):
         node = self.root
@@ -117,6 +128,9 @@ class Tree:
             stack[-1] = (node_list, cur_cid + 1)
             stack.append((cur_node.children, 0))
 
+        self.inserted.clear()
+        self.removed.clear()
+
     def update(self, path, version=None):
         self.getByPath(path).update(version=version)
 
@@ -127,30 +141,45 @@ class Tree:
             if would_be_at != len(node.children) and node.children[would_be_at] == label:
                 node = node.children[would_be_at]
             else:
+                parent = node
                 node = node.insert(label, version=version)
+                if parent.index is not None:
+                    self.inserted.append((parent, node))
         return node
 
     def remove(self, path):
-        self.getByPath(path[:-1]).remove(path[-1])
+        removed = [self.getByPath(path[:-1]).remove(path[-1])]
         for offset in range(1, len(path)):
             node = self.getByPath(path[:-offset])
             if len(node.children) == 0:
-                self.getByPath(path[: -(offset + 1)]).remove(node.label)
+                removed.append(self.getByPath(path[: -(offset + 1)]).remove(node.label))
             else:
                 break
+        self.removed.extend(node.index for node in removed if node.index is not None)
+
+    def edit_script(self):
+        # changes since the last setIndices, in the binary format read by parser::parse_edits
+        script = [struct.pack("<cI", b"D", index) for index in self.removed]
+        parents = {id(parent): parent for parent, _ in self.inserted}
+        inserted = {id(node) for _, node in self.inserted}
+        for parent in parents.values():
+            # insertions sharing a position must appear in child order
+            position = 0
+            for child in parent.children:
+                if id(child) in inserted:
+                    script.append(struct.pack("<cII", b"I", parent.index, position) + child.encode())
+                elif child.index is not None:
+                    position += 1
+        return b"".join(script)
 
     def __str__(self):
         return str(self.root)
 
 
-def get_baseline(at_id: str):
-    tree = Tree()
-    files = subprocess.run(
+def get_files(at_id: str):
+    return subprocess.run(
         ["git", "ls-tree", "--full-tree", "--name-only", "-r", at_id], capture_output=True, text=True
     ).stdout.splitlines()
-    for path in map(lambda f: f.split(os.path.sep), files):
-        tree.insert(path, version=at_id)
-    return tree
 
 
 def get_commits(from_id: str, to_id: str):
@@ -167,32 +196,186 @@ def get_diff(commit_id: str, parent_id: Optional[str] = None):
     ).stdout.splitlines()
 
 
-def get_edits(tree: Tree, commit_id: str, parent_id: Optional[str] = None):
-    only_revisions = True
+def get_changes(commit_id: str, parent_id: Optional[str] = None):
+    # the insertions, deletions and renames of a diff, as (mode, *paths); modifications don't change the tree
+    changes = []
     for mode, *paths in map(lambda l: l.split(), get_diff(commit_id, parent_id)):
+        if mode[0] in "ADR":
+            changes.append((mode[0], *paths))
+    return changes
+
+
+def invert_changes(changes):
+    inverse = {"A": "D", "D": "A", "R": "R"}
+    return [(inverse[mode], *reversed(paths)) for mode, *paths in changes]
+
+
+def apply_changes(tree: Tree, changes, version: str):
+    # returns whether the tree is unchanged, i.e. the commit only had modifications
+    for mode, *paths in changes:
         files = [tuple(path.split(os.path.sep)) for path in paths]
-        if mode[0] == "M":
-            continue
-        elif mode[0] == "A":
-            tree.insert(files[0], version=commit_id)
-            only_revisions = False
-        elif mode[0] == "D":
+        if mode == "A":
+            tree.insert(files[0], version=version)
+        elif mode == "D":
             tree.remove(files[0])
-            only_revisions = False
-        elif mode[0] == "R":
+        elif mode == "R":
             tree.remove(files[0])
-            tree.insert(files[1], version=commit_id)
-            only_revisions = False
-    return only_revisions
+            tree.insert(files[1], version=version)
+    return len(changes) == 0
+
+
+def net_changes(steps):
+    # several consecutive diffs as one, like a diff across all of them; renames come out as a deletion and an
+    # insertion, which apply_changes treats the same way
+    added, removed = set(), set()
+    for changes in steps:
+        for mode, *paths in changes:
+            if mode in "DR":
+                if paths[0] in added:
+                    added.remove(paths[0])
+                else:
+                    removed.add(paths[0])
+            if mode in "AR":
+                if paths[-1] in removed:
+                    removed.remove(paths[-1])
+                else:
+                    added.add(paths[-1])
+    return sorted([("D", path) for path in removed] + [("A", path) for path in added], key=lambda change: change[1])
+
+
+def tree_of(files, version: str):
+    tree = Tree()
+    for path in map(lambda f: f.split(os.path.sep), files):
+        tree.insert(path, version=version)
+    return tree
 
 
-def run_test(
-    data_dir: str,
-    t1_ref: Union[str, List[str]],
-    t2_ref: Union[str, List[str]],
-    save_as: Optional[str] = None,
-    drop_zeroes: bool = True,
-):
+class Corpus:
+    # Changesets extracted from git once, so that runs need no git calls. Little-endian, with strings as a
+    # u32 length and utf-8 bytes:
+    #   "TEDC" version ranges (from to offset)*   u32 version and count, u64 offsets
+    # then at each offset, for the range from..to:
+    #   count file*                               u32 count, the files at from
+    #   count file*                               the files at to
+    #   commits (id changes (mode path+)*)*       u32 counts, u8 mode 'A', 'D' or 'R' (with two paths)
+    # where each commit's changes are relative to the commit before it, or to from for the first.
+
+    VERSION = 1
+
+    @staticmethod
+    def extract(path: str, ranges):
+        def string(value: str):
+            data = value.encode()
+            return struct.pack("<I", len(data)) + data
+
+        def strings(values):
+            return struct.pack("<I", len(values)) + b"".join(map(string, values))
+
+        # written under another name first, so an interrupted extraction isn't mistaken for a corpus
+        with open(path + ".partial", "wb") as out:
+            header = b"TEDC" + struct.pack("<II", Corpus.VERSION, len(ranges))
+            offsets_at = []
+            for from_id, to_id in ranges:
+                header += string(from_id) + string(to_id)
+                offsets_at.append(len(header))
+                header += struct.pack("<Q", 0)
+            out.write(header)
+
+            for (from_id, to_id), offset_at in zip(ranges, offsets_at):
+                print("Extracting", from_id, "to", to_id)
+                offset = out.tell()
+
+                out.write(strings(get_files(from_id)) + strings(get_files(to_id)))
+
+                commits = get_commits(from_id, to_id)
+                out.write(struct.pack("<I", len(commits)))
+                parent_id = from_id
+                for commit_id in commits:
+                    changes = get_changes(commit_id, parent_id)
+                    out.write(string(commit_id) + struct.pack("<I", len(changes)))
+                    for mode, *paths in changes:
+                        out.write(mode.encode() + b"".join(map(string, paths)))
+                    parent_id = commit_id
+
+                end = out.tell()
+                out.seek(offset_at)
+                out.write(struct.pack("<Q", offset))
+                out.seek(end)
+
+        os.replace(path + ".partial", path)
+
+    def __init__(self, path: str):
+        with open(path, "rb") as f:
+            self.data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        if self.data[:4] != b"TEDC" or struct.unpack_from("<I", self.data, 4)[0] != Corpus.VERSION:
+            print("ERROR:", path, "is not a corpus of version", Corpus.VERSION)
+            exit(1)
+        ranges, self.at = struct.unpack_from("<I", self.data, 8)[0], 12
+        self.offsets = {}
+        for _ in range(ranges):
+            from_id, to_id = self.string(), self.string()
+            self.offsets[(from_id, to_id)] = struct.unpack_from("<Q", self.data, self.at)[0]
+            self.at += 8
+
+    def u32(self):
+        value = struct.unpack_from("<I", self.data, self.at)[0]
+        self.at += 4
+        return value
+
+    def string(self):
+        length = self.u32()
+        self.at += length
+        return self.data[self.at - length : self.at].decode()
+
+    def changesets(self, from_id: str, to_id: str):
+        self.at = self.offsets[(from_id, to_id)]
+        from_files = [self.string() for _ in range(self.u32())]
+        to_files = [self.string() for _ in range(self.u32())]
+        commits, changes = [], []
+        for _ in range(self.u32()):
+            commits.append(self.string())
+            commit_changes = []
+            for _ in range(self.u32()):
+                mode = chr(self.data[self.at])
+                self.at += 1
+                commit_changes.append((mode, *[self.string() for _ in range(2 if mode == "R" else 1)]))
+            changes.append(commit_changes)
+        return Changesets(from_id, to_id, from_files, to_files, commits, changes)
+
+
+class Changesets:
+    # one range of a corpus, replayable forwards or backwards between any two of its commits
+    def __init__(self, from_id, to_id, from_files, to_files, commits, changes):
+        self.from_id, self.to_id = from_id, to_id
+        self.from_files, self.to_files = from_files, to_files
+        self.commits, self.changes = commits, changes
+        self.position = {commit_id: i for i, commit_id in enumerate(commits)}
+
+    def baseline(self, at_id: str):
+        if at_id == self.from_id:
+            return tree_of(self.from_files, at_id)
+        if at_id == self.to_id:
+            return tree_of(self.to_files, at_id)
+        tree = tree_of(self.from_files, at_id)
+        for changes in self.changes[: self.position[at_id] + 1]:
+            apply_changes(tree, changes, at_id)
+        return tree
+
+    def edits(self, tree: Tree, commit_id: str, parent_id: str):
+        i, j = self.position[commit_id], self.position[parent_id]
+        if i > j:
+            steps = self.changes[j + 1 : i + 1]
+        else:
+            steps = [invert_changes(changes) for changes in reversed(self.changes[i + 1 : j + 1])]
+        return apply_changes(tree, steps[0] if len(steps) == 1 else net_changes(steps), commit_id)
+
+
+def numbers(output: str):
+    # the values after the label of a line from bin/ted; times are fractional milliseconds
+    return [int(value) if value.lstrip("-").isdigit() else float(value) for value in output.split(":")[1].split()]
+
+
+def pair_refs(t1_ref: Union[str, List[str]], t2_ref: Union[str, List[str]]):
     t1_is_fixed = not isinstance(t1_ref, list)
     t2_is_fixed = not isinstance(t2_ref, list)
 
@@ -207,20 +390,78 @@ def run_test(
         print("ERROR: different reflist lengths", t1_is_fixed, t2_is_fixed)
         exit(1)
 
+    return t1_refs, t2_refs, t1_is_fixed, t2_is_fixed
+
+
+def chunk(data: Optional[bytes]):
+    # one field of a replay, None marking a tree the step leaves unchanged, see parser::parse_replay
+    return struct.pack("<I", 0xFFFFFFFF) if data is None else struct.pack("<I", len(data)) + data
+
+
+def record_test(
+    changesets: Changesets,
+    data_dir: str,
+    t1_ref: Union[str, List[str]],
+    t2_ref: Union[str, List[str]],
+    save_as: Optional[str] = None,
+    drop_zeroes: bool = True,
+):
+    # writes the run as a replay for bin/bench instead of running it, see parser::parse_replay
+    t1_refs, t2_refs, t1_is_fixed, t2_is_fixed = pair_refs(t1_ref, t2_ref)
+
     old_t1, old_t2 = t1_refs[0], t2_refs[0]
-    t1, t2 = get_baseline(old_t1), get_baseline(old_t2)
+    t1, t2 = changesets.baseline(old_t1), changesets.baseline(old_t2)
 
-    ted = subprocess.Popen(sys.argv[1], stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=sys.stderr)
+    with open(save_as, "wb") as out:
+        out.write(chunk(str(t1).encode()) + chunk(str(t2).encode()))
+
+        for new_t1, new_t2 in zip(t1_refs[1:], t2_refs[1:]):
+            t1.setIndices()
+            t2.setIndices()
+
+            if (
+                all(
+                    [
+                        t1_is_fixed or changesets.edits(t1, new_t1, old_t1),
+                        t2_is_fixed or changesets.edits(t2, new_t2, old_t2),
+                    ]
+                )
+                and drop_zeroes
+            ):
+                continue
+
+            out.write(chunk(None if t1_is_fixed else t1.edit_script()) + chunk(None if t2_is_fixed else t2.edit_script()))
+            print(new_t1, new_t2)
+
+            old_t1, old_t2 = new_t1, new_t2
+
+
+def run_test(
+    changesets: Changesets,
+    data_dir: str,
+    t1_ref: Union[str, List[str]],
+    t2_ref: Union[str, List[str]],
+    save_as: Optional[str] = None,
+    drop_zeroes: bool = True,
+):
+    t1_refs, t2_refs, t1_is_fixed, t2_is_fixed = pair_refs(t1_ref, t2_ref)
+
+    old_t1, old_t2 = t1_refs[0], t2_refs[0]
+    t1, t2 = changesets.baseline(old_t1), changesets.baseline(old_t2)
+
+    ted = subprocess.Popen([sys.argv[1]] + (["--edit-scripts"] if edit_scripts else []), stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=sys.stderr)
 
     with open(save_as, "w") as out:
         writer = csv.writer(out)
         writer.writerow(
             [
                 "Edit-Distance",
-                "Dynamic-Subproblems",
+                "Dynamic-Subproblems",  # banded forest cells ForestDistance computes; the Touzet columns count their own tree_dist's
                 "Dynamic-Time",
-                "Dynamic-Hit",
-                "Dynamic-Missed",
+                "Dynamic-Hit",  # pairs reused from wherever the retained band holds them, not only within the old k
+                "Dynamic-Missed",  # pairs recomputed; with --lazy, hit + missed only count the pairs touched
+                "Dynamic-Initial-K",
+                "Dynamic-Final-K",
                 "Bounded-TopDiff-Subproblems",
                 "Bounded-TopDiff-Time",
                 "Bounded-Touzet-Subproblems",
@@ -261,8 +502,8 @@ def run_test(
             if (
                 all(
                     [
-                        t1_is_fixed or get_edits(t1, new_t1, parent_id=old_t1),
-                        t2_is_fixed or get_edits(t2, new_t2, parent_id=old_t2),
+                        t1_is_fixed or changesets.edits(t1, new_t1, old_t1),
+                        t2_is_fixed or changesets.edits(t2, new_t2, old_t2),
                     ]
                 )
                 and drop_zeroes
@@ -270,15 +511,15 @@ def run_test(
                 continue
 
             if not t1_is_fixed:
-                with open(data_dir + os.path.sep + old_t1 + "-" + new_t1, "w") as f1:
-                    f1.write(str(t1))
+                with open(data_dir + os.path.sep + old_t1 + "-" + new_t1, "wb") as f1:
+                    f1.write(t1.edit_script() if edit_scripts else str(t1).encode())
                     ted.stdin.write(f1.name.encode())
 
             ted.stdin.write("\n".encode())
 
             if not t2_is_fixed:
-                with open(data_dir + os.path.sep + old_t2 + "-" + new_t2, "w") as f2:
-                    f2.write(str(t2))
+                with open(data_dir + os.path.sep + old_t2 + "-" + new_t2, "wb") as f2:
+                    f2.write(t2.edit_script() if edit_scripts else str(t2).encode())
                     ted.stdin.write(f2.name.encode())
 
             ted.stdin.write("\n".encode())
@@ -287,31 +528,31 @@ def run_test(
             print(new_t1, new_t2)
 
             output = ted.stdout.readline().decode()
-            prep_t1 = list(map(int, output.split(":")[1].split()))
+            prep_t1 = numbers(output)
             print(output)
 
             output = ted.stdout.readline().decode()
-            prep_t2 = list(map(int, output.split(":")[1].split()))
+            prep_t2 = numbers(output)
             print(output)
 
             output = ted.stdout.readline().decode()
-            dynamic = list(map(int, output.split(":")[1].split()))
+            dynamic = numbers(output)
             print(output)
 
             output = ted.stdout.readline().decode()
-            b_topdiff = list(map(int, output.split(":")[1].split()))
+            b_topdiff = numbers(output)
             print(output)
 
             output = ted.stdout.readline().decode()
-            b_touzet = list(map(int, output.split(":")[1].split()))
+            b_touzet = numbers(output)
             print(output)
 
             output = ted.stdout.readline().decode()
-            bf_topdiff = list(map(int, output.split(":")[1].split()))
+            bf_topdiff = numbers(output)
             print(output)
 
             output = ted.stdout.readline().decode()
-            bf_touzet = list(map(int, output.split(":")[1].split()))
+            bf_touzet = numbers(output)
             print(output)
 
             if dynamic[0] != bf_touzet[0]:
@@ -335,60 +576,96 @@ def run_test(
     ted.kill()
 
 
-if len(sys.argv) != 4:
-    print("Usage: <ted executable path> <scratch path> <output path>")
-    exit(1)
-
-input("This script should be run from within a copy of the linux git repo. Send a newline to continue.")
-
-data_dir = sys.argv[2]
-out_dir = sys.argv[3]
-
-has_8_rc = {0, 3, 9, 12, 16, 17, 19}
-
-tags = [
-    (
-        "v5." + str(v - 1),
-        [
-            "v5.12-rc1-dontuse" if rc == 1 and v == 12 else "v5." + str(v) + "-rc" + str(rc)
-            for rc in range(1, 9 if v in has_8_rc else 8)
-        ],
-        "v5." + str(v),
-    )
-    for v in range(1, 20)
-]
-
-for from_v, rcs, to_v in tags:
-    commits = get_commits(from_v, to_v)
-
-    # per- commit forwards (ideal, insertion heavy)
-    run_test(
-        data_dir,
-        from_v,
-        commits,
-        save_as=out_dir + os.path.sep + from_v + "_to_" + to_v + "_per-commit_t1-fixed_fwd.csv",
-    )
-
-    # per- commit forwards decreasing distance (overestimate, insertion heavy)
-    run_test(
-        data_dir,
-        commits,
-        to_v,
-        save_as=out_dir + os.path.sep + from_v + "_to_" + to_v + "_per-commit_t2-fixed_fwd.csv",
-    )
-
-    # per- commit backwards (ideal, deletion heavy)
-    run_test(
-        data_dir,
-        to_v,
-        list(reversed(commits)),
-        save_as=out_dir + os.path.sep + from_v + "_to_" + to_v + "_per-commit_t1-fixed_rev.csv",
-    )
-
-    # per- commit backwards decreasing distance (overestimate, deletion heavy)
-    run_test(
-        data_dir,
-        list(reversed(commits)),
-        from_v,
-        save_as=out_dir + os.path.sep + from_v + "_to_" + to_v + "_per-commit_t2-fixed_rev.csv",
-    )
+# send per-commit binary edit scripts instead of re-serialising whole trees (set by main from --edit-scripts)
+edit_scripts = False
+
+
+def main():
+    global edit_scripts
+
+    edit_scripts = "--edit-scripts" in sys.argv
+    if edit_scripts:
+        sys.argv.remove("--edit-scripts")
+
+    # write each run to the scratch directory as a replay for bin/bench, rather than running bin/ted
+    record = "--record" in sys.argv
+    if record:
+        sys.argv.remove("--record")
+
+    if len(sys.argv) != 4:
+        print("Usage: <ted executable path> <scratch path> <output path> [--edit-scripts] [--record]")
+        exit(1)
+
+    data_dir = sys.argv[2]
+    out_dir = sys.argv[3]
+
+    test = record_test if record else run_test
+
+    def output(name: str):
+        return data_dir + os.path.sep + name + ".replay" if record else out_dir + os.path.sep + name + ".csv"
+
+    has_8_rc = {0, 3, 9, 12, 16, 17, 19}
+
+    tags = [
+        (
+            "v5." + str(v - 1),
+            [
+                "v5.12-rc1-dontuse" if rc == 1 and v == 12 else "v5." + str(v) + "-rc" + str(rc)
+                for rc in range(1, 9 if v in has_8_rc else 8)
+            ],
+            "v5." + str(v),
+        )
+        for v in range(1, 20)
+    ]
+
+    # every variant replays from the same corpus, so git is only needed the first time
+    corpus_path = data_dir + os.path.sep + "changesets.corpus"
+    if not os.path.exists(corpus_path):
+        input("This script should be run from within a copy of the linux git repo. Send a newline to continue.")
+        Corpus.extract(corpus_path, [(from_v, to_v) for from_v, _, to_v in tags])
+
+    corpus = Corpus(corpus_path)
+
+    for from_v, rcs, to_v in tags:
+        changesets = corpus.changesets(from_v, to_v)
+        commits = changesets.commits
+
+        # per- commit forwards (ideal, insertion heavy)
+        test(
+            changesets,
+            data_dir,
+            from_v,
+            commits,
+            save_as=output(from_v + "_to_" + to_v + "_per-commit_t1-fixed_fwd"),
+        )
+
+        # per- commit forwards decreasing distance (overestimate, insertion heavy)
+        test(
+            changesets,
+            data_dir,
+            commits,
+            to_v,
+            save_as=output(from_v + "_to_" + to_v + "_per-commit_t2-fixed_fwd"),
+        )
+
+        # per- commit backwards (ideal, deletion heavy)
+        test(
+            changesets,
+            data_dir,
+            to_v,
+            list(reversed(commits)),
+            save_as=output(from_v + "_to_" + to_v + "_per-commit_t1-fixed_rev"),
+        )
+
+        # per- commit backwards decreasing distance (overestimate, deletion heavy)
+        test(
+            changesets,
+            data_dir,
+            list(reversed(commits)),
+            from_v,
+            save_as=output(from_v + "_to_" + to_v + "_per-commit_t2-fixed_rev"),
+        )
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,107 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+#include "band-scheduler.fwd.hpp"
+#include "forest-distance.hpp"
+
+#include "matrix.h"
+
+#include <atomic>
+#include <barrier>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace ted {
+
+    // Computes a batch of band cells td(x, y) across a pool of threads.
+    // td(x, y) only reads td(i, j) for pairs of descendants (i in x, j in y, not both the roots), so cells
+    // are run level by level with level(x, y) = height(x) + height(y), which strictly decreases along every
+    // dependency. Within a level, workers take chunks of cells from a shared cursor.
+    // Each worker runs its own ForestDistance with private scratch, so the result doesn't depend on the
+    // number of threads or the order cells are taken in.
+    template <typename CostModel, typename TreeIndex>
+    class BandScheduler {
+
+        struct Cell {
+            int x;
+            int y;
+            int e; // budget
+        };
+
+        struct Worker {
+            ForestDistance<CostModel, TreeIndex> distance;
+            long long int subproblems;
+        };
+
+        // called by the last thread to reach a barrier, before any are released
+        struct NextLevel {
+            BandScheduler* scheduler;
+            void operator()() noexcept;
+        };
+
+        const CostModel c_;
+
+        std::vector<Cell> cells_; // in the order pushed
+        std::vector<Cell> order_; // by level
+        std::vector<size_t> level_begin_; // into order_, with the end of the last level appended
+        std::vector<size_t> fill_;
+        std::vector<int> t1_height_, t2_height_, stack_;
+
+        std::vector<Worker> workers_;
+        std::vector<std::thread> threads_; // the caller of run is worker 0
+        std::barrier<NextLevel> sync_;
+
+        // the job, published to the other workers by the barrier
+        const TreeIndex* t1_;
+        const TreeIndex* t2_;
+        data_structures::BandMatrix<double>* td_;
+        int level_;
+        int levels_;
+        std::atomic<size_t> next_;
+        bool stop_;
+
+        void heights(const TreeIndex& t, std::vector<int>& height);
+        void work(const int worker);
+        void run_levels(Worker& worker);
+        double tree_dist(Worker& worker, const int x, const int y, const int e);
+
+    public:
+
+        BandScheduler(const CostModel& c, const int threads);
+        ~BandScheduler();
+
+        BandScheduler(const BandScheduler&) = delete;
+        BandScheduler& operator=(const BandScheduler&) = delete;
+
+        int threads() const;
+
+        // queues td(x, y) with budget e for the next run
+        void push(const int x, const int y, const int e);
+
+        // computes every queued cell into td, returning the number of subproblems
+        long long int run(const TreeIndex& t1, const TreeIndex& t2, data_structures::BandMatrix<double>& td);
+    };
+}
+
+#include "band-scheduler.imp.hpp"
\ No newline at end of file
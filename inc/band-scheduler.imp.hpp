@@ -0,0 +1,161 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+#include "band-scheduler.hpp"
+
+#include <algorithm>
+
+namespace ted {
+
+    template <typename CostModel, typename TreeIndex>
+    BandScheduler<CostModel, TreeIndex>::BandScheduler(const CostModel& c, const int threads) :
+        c_(c), workers_(std::max(1, threads)), sync_(std::max(1, threads), NextLevel{ this }),
+        t1_(nullptr), t2_(nullptr), td_(nullptr), level_(0), levels_(0), next_(0), stop_(false) {
+
+        for (int worker = 1; worker < static_cast<int>(workers_.size()); ++worker) {
+            threads_.emplace_back(&BandScheduler::work, this, worker);
+        }
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    BandScheduler<CostModel, TreeIndex>::~BandScheduler() {
+        stop_ = true;
+        if (!threads_.empty()) sync_.arrive_and_wait();
+        for (auto& thread : threads_) thread.join();
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    int BandScheduler<CostModel, TreeIndex>::threads() const {
+        return workers_.size();
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    void BandScheduler<CostModel, TreeIndex>::NextLevel::operator()() noexcept {
+        auto& s = *scheduler;
+        if (++s.level_ < s.levels_) s.next_.store(s.level_begin_[s.level_], std::memory_order_relaxed);
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    void BandScheduler<CostModel, TreeIndex>::push(const int x, const int y, const int e) {
+        cells_.push_back({ x, y, e });
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    long long int BandScheduler<CostModel, TreeIndex>::run(const TreeIndex& t1, const TreeIndex& t2, data_structures::BandMatrix<double>& td) {
+
+        if (cells_.empty()) return 0;
+
+        heights(t1, t1_height_);
+        heights(t2, t2_height_);
+
+        // counting sort of the cells by level
+        levels_ = 0;
+        for (auto& cell : cells_) levels_ = std::max(levels_, t1_height_[cell.x] + t2_height_[cell.y] + 1);
+
+        level_begin_.assign(levels_ + 1, 0);
+        for (auto& cell : cells_) level_begin_[t1_height_[cell.x] + t2_height_[cell.y] + 1]++;
+        for (int level = 0; level < levels_; ++level) level_begin_[level + 1] += level_begin_[level];
+
+        fill_.assign(level_begin_.begin(), level_begin_.end() - 1);
+        order_.resize(cells_.size());
+        for (auto& cell : cells_) order_[fill_[t1_height_[cell.x] + t2_height_[cell.y]]++] = cell;
+
+        cells_.clear();
+
+        t1_ = &t1;
+        t2_ = &t2;
+        td_ = &td;
+
+        for (auto& worker : workers_) worker.subproblems = 0;
+
+        if (threads_.empty()) {
+            // levels are already in dependency order
+            for (auto& cell : order_) td.at(cell.x, cell.y) = tree_dist(workers_[0], cell.x, cell.y, cell.e);
+        }
+        else {
+            level_ = -1;
+            sync_.arrive_and_wait(); // releases the other workers into level 0
+            run_levels(workers_[0]);
+        }
+
+        long long int subproblems = 0;
+        for (auto& worker : workers_) subproblems += worker.subproblems;
+        return subproblems;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    void BandScheduler<CostModel, TreeIndex>::heights(const TreeIndex& t, std::vector<int>& height) {
+
+        // in postorder, the children of x are the subtree roots still pending within x's range
+        height.resize(t.tree_size_);
+        stack_.clear();
+
+        for (int x = 0; x < t.tree_size_; ++x) {
+            const int first = x - t.postl_to_size_[x] + 1;
+            int h = 0;
+            while (!stack_.empty() && stack_.back() >= first) {
+                h = std::max(h, height[stack_.back()] + 1);
+                stack_.pop_back();
+            }
+            height[x] = h;
+            stack_.push_back(x);
+        }
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    void BandScheduler<CostModel, TreeIndex>::work(const int worker) {
+        while (true) {
+            sync_.arrive_and_wait(); // waits for a job
+            if (stop_) return;
+            run_levels(workers_[worker]);
+        }
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    void BandScheduler<CostModel, TreeIndex>::run_levels(Worker& worker) {
+
+        // counted locally, once past the last barrier the caller may already be setting up the next run
+        const int levels = levels_;
+
+        for (int level = 0; level < levels; ++level) {
+
+            const size_t begin = level_begin_[level];
+            const size_t end = level_begin_[level + 1];
+            const size_t chunk = std::max<size_t>(1, (end - begin) / (workers_.size() * 4));
+
+            for (size_t i = next_.fetch_add(chunk, std::memory_order_relaxed); i < end; i = next_.fetch_add(chunk, std::memory_order_relaxed)) {
+                for (size_t c = i; c < std::min(i + chunk, end); ++c) {
+                    const auto& cell = order_[c];
+                    td_->at(cell.x, cell.y) = tree_dist(worker, cell.x, cell.y, cell.e);
+                }
+            }
+
+            sync_.arrive_and_wait(); // the last to arrive moves everyone on to the next level
+        }
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    double BandScheduler<CostModel, TreeIndex>::tree_dist(Worker& worker, const int x, const int y, const int e) {
+        return worker.distance(c_, *t1_, *t2_, *td_, x, y, e, worker.subproblems);
+    }
+}
\ No newline at end of file
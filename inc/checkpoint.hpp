@@ -0,0 +1,81 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "checkpoint.fwd.hpp"
+#include "touzet-dynamic.hpp"
+#include "parser.hpp"
+
+#include "label_dictionary.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace ted {
+
+    // A pair's dynamic state between revisions (both trees, td_old_, d_old_ and k_old_), saved so that a
+    // restarted process can carry on from it rather than start over with a baseline. Little-endian:
+    //   "TEDK" version value_size   u32s, value_size being sizeof a retained cell
+    //   d_old k_old                 f64, i32
+    //   length bytes                u64 length, t1 in bracket notation
+    //   length bytes                t2 in bracket notation
+    //   band                        see RetainedBand::save
+    // The file is mapped lazily and the band read in place, so its pages are only read from disk when
+    // dynamic_ted_k first reuses their cells.
+    class Checkpoint {
+
+        std::shared_ptr<const parser::MappedFile> file_;
+        std::string_view t1_;
+        std::string_view t2_;
+        std::uint32_t value_size_;
+        double d_old_;
+        std::int32_t k_old_;
+        const char* band_;
+
+    public:
+
+        static constexpr std::uint32_t version = 1;
+
+        // writes the engine's state, with t1 and t2 the trees it was last run on
+        template <typename CostModel, typename TreeIndex, typename Label>
+        static void save(
+            const std::string& path, DynamicTozuetTreeIndex<CostModel, TreeIndex>& engine,
+            const TreeIndex& t1, const TreeIndex& t2, const label::LabelDictionary<Label>& labels
+        );
+
+        // maps a checkpoint, throwing std::runtime_error if it isn't one of this version
+        Checkpoint(const std::string& path);
+
+        // the trees, to be parsed and indexed by the caller
+        std::string_view t1() const;
+        std::string_view t2() const;
+
+        // Replaces the engine's state with the checkpoint's, which it may use after the Checkpoint is gone;
+        // t1 and t2 are the checkpoint's trees, as indexed by the caller. Throws std::runtime_error if the
+        // checkpoint was saved with another retained value type, or its band doesn't fit t1 and t2.
+        template <typename CostModel, typename TreeIndex>
+        void restore(DynamicTozuetTreeIndex<CostModel, TreeIndex>& engine, const TreeIndex& t1, const TreeIndex& t2) const;
+    };
+}
+
+#include "checkpoint.imp.hpp"
\ No newline at end of file
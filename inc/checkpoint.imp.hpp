@@ -0,0 +1,134 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "checkpoint.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace ted {
+
+    template <typename CostModel, typename TreeIndex, typename Label>
+    void Checkpoint::save(
+        const std::string& path, DynamicTozuetTreeIndex<CostModel, TreeIndex>& engine,
+        const TreeIndex& t1, const TreeIndex& t2, const label::LabelDictionary<Label>& labels
+    ) {
+        using Engine = DynamicTozuetTreeIndex<CostModel, TreeIndex>;
+
+        // written under another name first, so that a failed save leaves the last checkpoint intact
+        std::ofstream out(path + ".partial", std::ios::binary);
+
+        auto write = [&](auto value) { out.write(reinterpret_cast<const char*>(&value), sizeof(value)); };
+
+        auto write_tree = [&](const TreeIndex& t) {
+            std::ostringstream bracket;
+            parser::write_bracket(bracket, t, labels);
+            const auto text = bracket.str();
+            write(static_cast<std::uint64_t>(text.size()));
+            out.write(text.data(), text.size());
+        };
+
+        out.write("TEDK", 4);
+        write(version);
+
+        // the retained state is only reachable by swapping it out
+        typename Engine::PairState state;
+        engine.exchange(state);
+
+        write(static_cast<std::uint32_t>(state.td_old_.value_size()));
+        write(state.d_old_);
+        write(static_cast<std::int32_t>(state.k_old_));
+        write_tree(t1);
+        write_tree(t2);
+        state.td_old_.save(out);
+
+        engine.exchange(state);
+
+        out.close();
+        if (!out) throw std::runtime_error("failed to write checkpoint " + path);
+        if (std::rename((path + ".partial").c_str(), path.c_str()) != 0) throw std::runtime_error("failed to replace checkpoint " + path);
+    }
+
+    inline Checkpoint::Checkpoint(const std::string& path) : file_(std::make_shared<parser::MappedFile>(path, true)) {
+
+        const auto source = file_->view();
+        const char* it = source.data();
+        const char* const end = it + source.size();
+
+        auto read = [&](auto& value) {
+            if (end - it < static_cast<std::ptrdiff_t>(sizeof(value))) throw std::runtime_error("truncated checkpoint " + path);
+            std::memcpy(&value, it, sizeof(value));
+            it += sizeof(value);
+        };
+
+        auto read_tree = [&]() {
+            std::uint64_t length;
+            read(length);
+            if (static_cast<std::uint64_t>(end - it) < length) throw std::runtime_error("truncated checkpoint " + path);
+            auto tree = std::string_view(it, length);
+            it += length;
+            return tree;
+        };
+
+        if (source.substr(0, 4) != "TEDK") throw std::runtime_error(path + " is not a checkpoint");
+        it += 4;
+
+        std::uint32_t file_version;
+        read(file_version);
+        if (file_version != version) throw std::runtime_error(path + " is a checkpoint of another version");
+
+        read(value_size_);
+        read(d_old_);
+        read(k_old_);
+        t1_ = read_tree();
+        t2_ = read_tree();
+        band_ = it;
+    }
+
+    inline std::string_view Checkpoint::t1() const {
+        return t1_;
+    }
+
+    inline std::string_view Checkpoint::t2() const {
+        return t2_;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    void Checkpoint::restore(DynamicTozuetTreeIndex<CostModel, TreeIndex>& engine, const TreeIndex& t1, const TreeIndex& t2) const {
+
+        using Engine = DynamicTozuetTreeIndex<CostModel, TreeIndex>;
+
+        if (!Engine::Retained::holds(value_size_)) throw std::runtime_error("checkpoint is of another cost model");
+
+        const auto source = file_->view();
+
+        typename Engine::PairState state;
+        state.d_old_ = d_old_;
+        state.k_old_ = k_old_;
+        state.td_old_.load(value_size_, t1.tree_size_, t2.tree_size_, band_, source.data(), source.data() + source.size(), file_);
+
+        engine.exchange(state);
+    }
+}
\ No newline at end of file
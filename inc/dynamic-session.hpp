@@ -0,0 +1,99 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+#include "dynamic-session.fwd.hpp"
+
+#include "touzet-dynamic.hpp"
+
+#include <cstddef>
+#include <string>
+#include <map>
+#include <optional>
+#include <unordered_map>
+
+namespace ted {
+
+    // Tracks many (t1, t2) pairs in one process. Trees are registered by id and may take part in any
+    // number of pairs: each revision of a tree is preprocessed once against its previous revision,
+    // then every pair involving it is brought up to date from its own retained band.
+    // Revisions are staged with revise_tree and take effect together on commit, so a pair whose trees
+    // both changed in the same step is updated once.
+    template <typename CostModel, typename TreeIndex>
+    class DynamicSession {
+
+    public:
+
+        using Engine = DynamicTozuetTreeIndex<CostModel, TreeIndex>;
+
+    private:
+
+        struct Tree {
+            TreeIndex index;
+            std::optional<TreeIndex> staged;
+            typename Engine::Revision revision; // index -> staged
+        };
+
+        struct Pair {
+            std::string t1;
+            std::string t2;
+            typename Engine::PairState state;
+            bool baseline; // not computed yet
+        };
+
+        Engine engine_;
+
+        std::unordered_map<std::string, Tree> trees_;
+        std::map<std::string, Pair> pairs_; // ordered, so commits report in a stable order
+
+        Tree& find_tree(const std::string& id);
+
+    public:
+
+        DynamicSession(const CostModel& c);
+
+        // the engine's flags (adaptive_bound, ...) apply to every pair
+        Engine& engine();
+
+        void add_tree(const std::string& id, TreeIndex index);
+
+        // stages the next revision of a tree, preprocessing it against the current one straight away
+        void revise_tree(const std::string& id, TreeIndex index, const std::unordered_map<size_t, size_t>& preserved_nodes);
+
+        // the current (last committed) revision
+        const TreeIndex& tree(const std::string& id) const;
+
+        // the preprocessing of the last revision staged
+        const typename Engine::Revision& revision(const std::string& id) const;
+
+        // the pair is computed from scratch on the next commit
+        void track(const std::string& id, const std::string& t1, const std::string& t2);
+        void untrack(const std::string& id);
+
+        // brings every pair with a new or revised tree up to date, calling report(id, engine) after
+        // each so the engine's counters can be read, then makes the staged revisions current
+        template <typename Report>
+        void commit(Report&& report);
+    };
+}
+
+#include "dynamic-session.imp.hpp"
\ No newline at end of file
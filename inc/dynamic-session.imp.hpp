@@ -0,0 +1,130 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+#include "dynamic-session.hpp"
+
+#include <stdexcept>
+#include <utility>
+
+namespace ted {
+
+    template <typename CostModel, typename TreeIndex>
+    DynamicSession<CostModel, TreeIndex>::DynamicSession(const CostModel& c) : engine_(c) {}
+
+    template <typename CostModel, typename TreeIndex>
+    typename DynamicSession<CostModel, TreeIndex>::Engine& DynamicSession<CostModel, TreeIndex>::engine() {
+        return engine_;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    typename DynamicSession<CostModel, TreeIndex>::Tree& DynamicSession<CostModel, TreeIndex>::find_tree(const std::string& id) {
+        auto tree = trees_.find(id);
+        if (tree == trees_.end()) throw std::runtime_error("Unknown tree: " + id);
+        return tree->second;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    void DynamicSession<CostModel, TreeIndex>::add_tree(const std::string& id, TreeIndex index) {
+        auto [tree, added] = trees_.try_emplace(id);
+        if (!added) throw std::runtime_error("Tree already exists: " + id);
+        tree->second.index = std::move(index);
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    void DynamicSession<CostModel, TreeIndex>::revise_tree(
+        const std::string& id, TreeIndex index,
+        const std::unordered_map<size_t, size_t>& preserved_nodes // new_prel -> old_prel
+    ) {
+        auto& tree = find_tree(id);
+        if (tree.staged.has_value()) throw std::runtime_error("Tree already revised in this step: " + id);
+
+        engine_.preprocess(tree.index, index, preserved_nodes, tree.revision);
+        tree.staged = std::move(index);
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    const TreeIndex& DynamicSession<CostModel, TreeIndex>::tree(const std::string& id) const {
+        auto tree = trees_.find(id);
+        if (tree == trees_.end()) throw std::runtime_error("Unknown tree: " + id);
+        return tree->second.index;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    const typename DynamicSession<CostModel, TreeIndex>::Engine::Revision& DynamicSession<CostModel, TreeIndex>::revision(const std::string& id) const {
+        auto tree = trees_.find(id);
+        if (tree == trees_.end()) throw std::runtime_error("Unknown tree: " + id);
+        return tree->second.revision;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    void DynamicSession<CostModel, TreeIndex>::track(const std::string& id, const std::string& t1, const std::string& t2) {
+        find_tree(t1);
+        find_tree(t2);
+        auto [pair, added] = pairs_.try_emplace(id);
+        if (!added) throw std::runtime_error("Pair already exists: " + id);
+        pair->second.t1 = t1;
+        pair->second.t2 = t2;
+        pair->second.baseline = true;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    void DynamicSession<CostModel, TreeIndex>::untrack(const std::string& id) {
+        if (!pairs_.erase(id)) throw std::runtime_error("Unknown pair: " + id);
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    template <typename Report>
+    void DynamicSession<CostModel, TreeIndex>::commit(Report&& report) {
+
+        for (auto& [id, pair] : pairs_) {
+
+            const auto& t1 = trees_.at(pair.t1);
+            const auto& t2 = trees_.at(pair.t2);
+
+            const bool t1_revised = t1.staged.has_value();
+            const bool t2_revised = t2.staged.has_value();
+
+            if (!pair.baseline && !t1_revised && !t2_revised) continue;
+
+            const TreeIndex& t1_index = t1_revised ? *t1.staged : t1.index;
+            const TreeIndex& t2_index = t2_revised ? *t2.staged : t2.index;
+
+            engine_.exchange(pair.state);
+
+            if (pair.baseline) engine_.ted(t1_index, t2_index);
+            else engine_.ted(t1_index, t1_revised ? &t1.revision : nullptr, t2_index, t2_revised ? &t2.revision : nullptr);
+
+            report(id, std::as_const(engine_));
+
+            engine_.exchange(pair.state);
+
+            pair.baseline = false;
+        }
+
+        for (auto& [id, tree] : trees_) {
+            if (!tree.staged.has_value()) continue;
+            tree.index = std::move(*tree.staged);
+            tree.staged.reset();
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,99 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "edit-mapping.fwd.hpp"
+#include "forest-distance.hpp"
+
+#include "matrix.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ted {
+
+    // An optimal edit mapping between two trees, backtraced through a band of subtree distances. Mapped
+    // nodes with different labels are renamed, nodes of t1 left unmapped are deleted and nodes of t2 left
+    // unmapped are inserted.
+    // Each subtree pair the backtrace descends into is recorded as a fragment, the span of pairs it
+    // mapped. The next revision's backtrace copies a fragment whole, shifted to the new postl ids, when
+    // both its subtrees are preserved, rather than recompute the forest distances beneath it.
+    // Fragments only spare the work below the spine of changed pairs: the roots, like any pair on that
+    // spine, always get their forest distances recomputed with budget ceil(d), so every backtrace costs
+    // at least O(|t1| * d) however small the revision.
+    template <typename CostModel, typename TreeIndex>
+    class EditMapping {
+
+        struct Fragment {
+            int x;
+            int y;
+            size_t begin; // of its pairs
+            size_t end;
+            size_t nested; // index of the first fragment within this one; they're recorded innermost first
+        };
+
+        // a subtree pair whose own forest distances have been backtraced, and whose nested pairs are next
+        struct Frame {
+            int x;
+            int y;
+            size_t begin;
+            size_t nested;
+            size_t jumps_begin; // into jumps_
+            size_t jumps_next;
+            size_t jumps_end;
+        };
+
+        std::vector<std::pair<int, int>> pairs_;
+        std::vector<Fragment> fragments_;
+        std::unordered_map<std::uint64_t, size_t> index_; // (x, y) -> fragment
+
+        ForestDistance<CostModel, TreeIndex> distance_;
+        std::vector<Frame> stack_;
+        std::vector<std::pair<int, int>> jumps_;
+
+        static std::uint64_t key(const int x, const int y);
+
+        // appends the fragment of previous for (old_x, old_y), and every fragment nested in it, shifted onto (x, y)
+        void copy(const EditMapping& previous, const size_t fragment, const int x, const int y);
+
+    public:
+
+        // (t1 postl, t2 postl) for every mapped node, in no particular order
+        const std::vector<std::pair<int, int>>& pairs() const;
+
+        void clear();
+
+        // Backtraces the mapping of t1 onto t2, d apart, from the band td of their subtree distances.
+        // Fragments of previous are reused through the preserved subtree maps (new postl -> old postl, or
+        // negative where not preserved; nullptr if the tree is unchanged). previous must not be this.
+        void backtrace(
+            const CostModel& c, const TreeIndex& t1, const TreeIndex& t2,
+            data_structures::BandMatrix<double>& td, const double d,
+            const std::vector<int>* t1_preserved, const std::vector<int>* t2_preserved,
+            const EditMapping& previous
+        );
+    };
+}
+
+#include "edit-mapping.imp.hpp"
\ No newline at end of file
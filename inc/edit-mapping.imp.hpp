@@ -0,0 +1,155 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "edit-mapping.hpp"
+
+#include <cmath>
+
+namespace ted {
+
+    template <typename CostModel, typename TreeIndex>
+    std::uint64_t EditMapping<CostModel, TreeIndex>::key(const int x, const int y) {
+        return static_cast<std::uint64_t>(static_cast<std::uint32_t>(x)) << 32 | static_cast<std::uint32_t>(y);
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    const std::vector<std::pair<int, int>>& EditMapping<CostModel, TreeIndex>::pairs() const {
+        return pairs_;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    void EditMapping<CostModel, TreeIndex>::clear() {
+        pairs_.clear();
+        fragments_.clear();
+        index_.clear();
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    void EditMapping<CostModel, TreeIndex>::copy(const EditMapping& previous, const size_t fragment, const int x, const int y) {
+
+        const auto& source = previous.fragments_[fragment];
+
+        // identical subtrees have identical postorders, so every id moves by the same amount
+        const int dx = x - source.x;
+        const int dy = y - source.y;
+
+        const size_t begin = pairs_.size();
+        for (size_t pair = source.begin; pair < source.end; ++pair) {
+            pairs_.emplace_back(previous.pairs_[pair].first + dx, previous.pairs_[pair].second + dy);
+        }
+
+        const size_t nested = fragments_.size();
+        for (size_t f = source.nested; f <= fragment; ++f) {
+            const auto& old = previous.fragments_[f];
+            index_[key(old.x + dx, old.y + dy)] = fragments_.size();
+            fragments_.push_back({
+                old.x + dx, old.y + dy,
+                begin + (old.begin - source.begin), begin + (old.end - source.begin),
+                nested + (old.nested - source.nested)
+            });
+        }
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    void EditMapping<CostModel, TreeIndex>::backtrace(
+        const CostModel& c, const TreeIndex& t1, const TreeIndex& t2,
+        data_structures::BandMatrix<double>& td, const double d,
+        const std::vector<int>* t1_preserved, const std::vector<int>* t2_preserved,
+        const EditMapping& previous
+    ) {
+        clear();
+
+        if (std::isinf(d)) return;
+
+        auto old_node = [](const std::vector<int>* preserved, const int node) { return preserved ? (*preserved)[node] : node; };
+
+        // copies the fragment of (x, y) if there is one, otherwise backtraces its forest distances and pushes
+        // a frame for the subtree pairs they descend into
+        auto enter = [&](const int x, const int y, const double distance) {
+
+            const size_t begin = pairs_.size();
+            const size_t nested = fragments_.size();
+
+            const int old_x = old_node(t1_preserved, x);
+            const int old_y = old_node(t2_preserved, y);
+            if (old_x >= 0 && old_y >= 0) {
+                auto found = previous.index_.find(key(old_x, old_y));
+                if (found != previous.index_.end()) {
+                    copy(previous, found->second, x, y);
+                    return;
+                }
+            }
+
+            // an optimal mapping never strays further than its own cost from the diagonal
+            long long int subproblems = 0;
+            distance_(c, t1, t2, td, x, y, static_cast<int>(std::ceil(distance)), subproblems);
+
+            const int x_off = x - t1.postl_to_size_[x];
+            const int y_off = y - t2.postl_to_size_[y];
+            const size_t jumps_begin = jumps_.size();
+
+            for (int i = t1.postl_to_size_[x], j = t2.postl_to_size_[y]; i > 0 || j > 0;) {
+
+                const double here = distance_.forest(i, j);
+
+                if (i > 0 && here == distance_.forest(i - 1, j) + c.del(t1.postl_to_label_id_[i + x_off])) --i;
+                else if (j > 0 && here == distance_.forest(i, j - 1) + c.ins(t2.postl_to_label_id_[j + y_off])) --j;
+                else {
+                    const int i_lld = t1.postl_to_lld_[i + x_off] - x_off;
+                    const int j_lld = t2.postl_to_lld_[j + y_off] - y_off;
+                    if (i_lld == 1 && j_lld == 1) {
+                        pairs_.emplace_back(i + x_off, j + y_off);
+                        --i;
+                        --j;
+                    }
+                    else {
+                        // the whole subtree pair, left for its own frame
+                        jumps_.emplace_back(i + x_off, j + y_off);
+                        i = i_lld - 1;
+                        j = j_lld - 1;
+                    }
+                }
+            }
+
+            stack_.push_back({ x, y, begin, nested, jumps_begin, jumps_begin, jumps_.size() });
+        };
+
+        enter(t1.tree_size_ - 1, t2.tree_size_ - 1, d);
+
+        while (!stack_.empty()) {
+
+            auto& frame = stack_.back();
+
+            if (frame.jumps_next < frame.jumps_end) {
+                const auto [x, y] = jumps_[frame.jumps_next++];
+                enter(x, y, td.read_at(x, y));
+                continue;
+            }
+
+            index_[key(frame.x, frame.y)] = fragments_.size();
+            fragments_.push_back({ frame.x, frame.y, frame.begin, pairs_.size(), frame.nested });
+
+            jumps_.resize(frame.jumps_begin);
+            stack_.pop_back();
+        }
+    }
+}
\ No newline at end of file
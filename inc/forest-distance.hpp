@@ -0,0 +1,85 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "forest-distance.fwd.hpp"
+
+#include "matrix.h"
+#include "unit_cost_model.h"
+
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+namespace ted {
+
+    // Whether a cost model's costs are all 1, but for renaming to an equal label id at 0, so that forest
+    // distances can be computed in integers and compared a row at a time.
+    template <typename CostModel>
+    struct UnitCost : std::false_type {};
+
+    template <typename Label>
+    struct UnitCost<cost_model::UnitCostModelLD<Label>> : std::true_type {};
+
+    // The banded forest distance behind a single band cell td(x, y) with budget e: the forest prefixes of x
+    // and y within e of the diagonal, reading td for pairs of descendants (i in x, j in y, not both the
+    // roots). Distances over e aren't exact, and are returned as infinite.
+    // Under UnitCost, rows are computed with integer vectors (AVX2 where the build targets it) instead: the
+    // insertion term of a row depends on the cell to its left, so each row takes the delete and rename
+    // terms across the whole row first, and then the insertions as a prefix minimum.
+    // Holds its own scratch, so each thread needs an instance of its own.
+    template <typename CostModel, typename TreeIndex>
+    class ForestDistance {
+
+        static constexpr std::int32_t inf = 1 << 29; // of the integer kernel, such that inf + inf + 1 can't overflow
+
+        std::vector<double> fd_; // banded by row, grown on demand
+        std::vector<std::int32_t> rows_; // banded by row, with a trailing inf after each, grown on demand
+
+        // of the last call, for forest
+        int e_ = -1;
+        int y_size_ = 0;
+
+        double generic(
+            const CostModel& c, const TreeIndex& t1, const TreeIndex& t2, data_structures::BandMatrix<double>& td,
+            const int x, const int y, const int e, long long int& subproblems
+        );
+
+        double unit_cost(
+            const TreeIndex& t1, const TreeIndex& t2, data_structures::BandMatrix<double>& td,
+            const int x, const int y, const int e, long long int& subproblems
+        );
+
+    public:
+
+        // td(x, y), counting each forest pair computed in subproblems
+        double operator()(
+            const CostModel& c, const TreeIndex& t1, const TreeIndex& t2, data_structures::BandMatrix<double>& td,
+            const int x, const int y, const int e, long long int& subproblems
+        );
+
+        // the forest distance of the first i nodes of x and the first j nodes of y, as of the last call,
+        // or infinity if that's outside its band
+        double forest(const int i, const int j) const;
+    };
+}
+
+#include "forest-distance.imp.hpp"
\ No newline at end of file
@@ -0,0 +1,282 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "forest-distance.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace ted {
+
+    template <typename CostModel, typename TreeIndex>
+    double ForestDistance<CostModel, TreeIndex>::operator()(
+        const CostModel& c, const TreeIndex& t1, const TreeIndex& t2, data_structures::BandMatrix<double>& td,
+        const int x, const int y, const int e, long long int& subproblems
+    ) {
+        if constexpr (UnitCost<CostModel>::value) return unit_cost(t1, t2, td, x, y, e, subproblems);
+        else return generic(c, t1, t2, td, x, y, e, subproblems);
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    double ForestDistance<CostModel, TreeIndex>::generic(
+        const CostModel& c, const TreeIndex& t1, const TreeIndex& t2, data_structures::BandMatrix<double>& td,
+        const int x, const int y, const int e, long long int& subproblems
+    ) {
+        constexpr double inf = std::numeric_limits<double>::infinity();
+
+        const int x_size = t1.postl_to_size_[x];
+        const int y_size = t2.postl_to_size_[y];
+
+        e_ = -1;
+        if (e < 0 || std::abs(x_size - y_size) > e) return inf;
+
+        e_ = e;
+        y_size_ = y_size;
+
+        // forest prefixes of the two subtrees, i and j count nodes from the left: postl = i + x_off
+        const int x_off = x - x_size;
+        const int y_off = y - y_size;
+
+        // only |i - j| <= e can be on a mapping within budget
+        const int width = 2 * e + 1;
+        const size_t needed = static_cast<size_t>(x_size + 1) * width;
+        if (fd_.size() < needed) fd_.resize(needed);
+
+        auto fd = [&](const int i, const int j) -> double& { return fd_[static_cast<size_t>(i) * width + (j - i + e)]; };
+        auto read = [&](const int i, const int j) { return (j < 0 || j > y_size || std::abs(i - j) > e) ? inf : fd(i, j); };
+
+        fd(0, 0) = 0;
+        for (int j = 1; j <= std::min(y_size, e); ++j) fd(0, j) = fd(0, j - 1) + c.ins(t2.postl_to_label_id_[j + y_off]);
+
+        for (int i = 1; i <= x_size; ++i) {
+
+            const int x_label = t1.postl_to_label_id_[i + x_off];
+            const int i_lld = t1.postl_to_lld_[i + x_off] - x_off;
+
+            if (i <= e) fd(i, 0) = fd(i - 1, 0) + c.del(x_label);
+
+            for (int j = std::max(1, i - e); j <= std::min(y_size, i + e); ++j) {
+
+                subproblems++;
+
+                const int y_label = t2.postl_to_label_id_[j + y_off];
+                const int j_lld = t2.postl_to_lld_[j + y_off] - y_off;
+
+                double distance = std::min(read(i - 1, j) + c.del(x_label), read(i, j - 1) + c.ins(y_label));
+
+                // both on the leftmost paths, the subtree distance is this forest distance itself
+                if (i_lld == 1 && j_lld == 1) distance = std::min(distance, read(i - 1, j - 1) + c.ren(x_label, y_label));
+                else distance = std::min(distance, read(i_lld - 1, j_lld - 1) + td.read_at(i + x_off, j + y_off));
+
+                fd(i, j) = distance;
+            }
+        }
+
+        // anything over budget isn't exact, and is never needed within it
+        const double distance = fd(x_size, y_size);
+        return distance <= e ? distance : inf;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    double ForestDistance<CostModel, TreeIndex>::unit_cost(
+        const TreeIndex& t1, const TreeIndex& t2, data_structures::BandMatrix<double>& td,
+        const int x, const int y, const int e, long long int& subproblems
+    ) {
+        const int x_size = t1.postl_to_size_[x];
+        const int y_size = t2.postl_to_size_[y];
+
+        e_ = -1;
+        if (e < 0 || std::abs(x_size - y_size) > e) return std::numeric_limits<double>::infinity();
+
+        e_ = e;
+        y_size_ = y_size;
+
+        const int x_off = x - x_size;
+        const int y_off = y - y_size;
+
+        // each row is followed by an inf, which is both the cell above-right of the next row's band and the
+        // cell left of it, so neither needs a bounds check
+        const int width = 2 * e + 1;
+        const int stride = width + 1;
+        const size_t needed = static_cast<size_t>(x_size + 1) * stride;
+        if (rows_.size() < needed) rows_.resize(needed);
+
+        // row i, indexed by j
+        auto row = [&](const int i) { return rows_.data() + static_cast<std::ptrdiff_t>(i) * stride + (e - i); };
+
+        const int* const y_labels = t2.postl_to_label_id_.data() + y_off;
+        const int* const y_llds = t2.postl_to_lld_.data() + y_off;
+        const long long int td_width = td.get_band_width();
+
+        std::int32_t* const first = row(0);
+        for (int j = 0; j <= std::min(y_size, e); ++j) first[j] = j;
+        rows_[width] = inf;
+
+        for (int i = 1; i <= x_size; ++i) {
+
+            const int x_label = t1.postl_to_label_id_[i + x_off];
+            const int i_lld = t1.postl_to_lld_[i + x_off] - x_off;
+
+            std::int32_t* const current = row(i);
+            const std::int32_t* const above = row(i - 1);
+            const std::int32_t* const lower = row(i_lld - 1); // the row before i's leftmost leaf
+            const int lower_i = i_lld - 1;
+
+            rows_[static_cast<size_t>(i) * stride + width] = inf;
+            if (i <= e) current[0] = i;
+
+            const int j_begin = std::max(1, i - e);
+            const int j_end = std::min(y_size, i + e);
+            if (j_begin > j_end) continue;
+
+            subproblems += j_end - j_begin + 1;
+
+            // the columns of this row of td that are within its band
+            const long long int td_row = i + x_off;
+            const int td_begin = static_cast<int>(std::max<long long int>(j_begin, td_row - td_width - y_off));
+            const int td_end = static_cast<int>(std::min<long long int>(j_end, td_row + td_width - y_off));
+            const double* const td_cells = td_begin <= td_end ? &td.at(td_row, td_begin + y_off) : nullptr; // from td_begin
+
+            // the delete and rename terms of cells [from, to], one at a time
+            auto cells = [&](const int from, const int to) {
+                for (int j = from; j <= to; ++j) {
+                    const int j_lld = y_llds[j] - y_off;
+                    std::int32_t distance;
+                    if (i_lld == 1 && j_lld == 1) distance = above[j - 1] + (x_label != y_labels[j]);
+                    else {
+                        const std::int32_t forest = std::abs(j_lld - 1 - lower_i) <= e ? lower[j_lld - 1] : inf;
+                        const double tree = j >= td_begin && j <= td_end ? td_cells[j - td_begin] : inf;
+                        distance = forest + (tree < inf ? static_cast<std::int32_t>(tree) : inf);
+                    }
+                    current[j] = std::min({ distance, above[j] + 1, inf });
+                }
+            };
+
+            int j = j_begin;
+
+#ifdef __AVX2__
+            const __m256i inf_v = _mm256_set1_epi32(inf);
+            const __m256i one_v = _mm256_set1_epi32(1);
+
+            for (; j + 7 <= j_end; j += 8) {
+
+                const __m256i labels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(y_labels + j));
+                const __m256i llds = _mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(y_llds + j)), _mm256_set1_epi32(y_off));
+
+                // fd(i_lld - 1, j_lld - 1), where it's within the band
+                const __m256i forest_j = _mm256_sub_epi32(llds, one_v);
+                const __m256i band_offset = _mm256_add_epi32(_mm256_sub_epi32(forest_j, _mm256_set1_epi32(lower_i)), _mm256_set1_epi32(e));
+                const __m256i in_band = _mm256_and_si256(
+                    _mm256_cmpgt_epi32(band_offset, _mm256_set1_epi32(-1)),
+                    _mm256_cmpgt_epi32(_mm256_set1_epi32(width), band_offset)
+                );
+                const __m256i forest = _mm256_mask_i32gather_epi32(inf_v, reinterpret_cast<const int*>(lower), forest_j, in_band, 4);
+
+                // td(i, j), where it's within td's band
+                __m256i tree;
+                if (j >= td_begin && j + 7 <= td_end) {
+                    const __m256d cap = _mm256_set1_pd(inf);
+                    const __m128i low = _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_loadu_pd(td_cells + (j - td_begin)), cap));
+                    const __m128i high = _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_loadu_pd(td_cells + (j - td_begin) + 4), cap));
+                    tree = _mm256_set_m128i(high, low);
+                }
+                else {
+                    alignas(32) std::int32_t lanes[8];
+                    for (int lane = 0; lane < 8; ++lane) {
+                        const int column = j + lane;
+                        const double cell = column >= td_begin && column <= td_end ? td_cells[column - td_begin] : inf;
+                        lanes[lane] = cell < inf ? static_cast<std::int32_t>(cell) : inf;
+                    }
+                    tree = _mm256_load_si256(reinterpret_cast<const __m256i*>(lanes));
+                }
+
+                __m256i distance = _mm256_add_epi32(forest, tree);
+
+                if (i_lld == 1) {
+                    // both on the leftmost paths, the subtree distance is this forest distance itself
+                    const __m256i rename = _mm256_add_epi32(
+                        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(above + j - 1)),
+                        _mm256_andnot_si256(_mm256_cmpeq_epi32(labels, _mm256_set1_epi32(x_label)), one_v)
+                    );
+                    distance = _mm256_blendv_epi8(distance, rename, _mm256_cmpeq_epi32(llds, one_v));
+                }
+
+                const __m256i deletion = _mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(above + j)), one_v);
+                distance = _mm256_min_epi32(_mm256_min_epi32(distance, deletion), inf_v);
+
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(current + j), distance);
+            }
+#endif
+
+            cells(j, j_end);
+
+            // insertions: fd(i, j) = min over j' <= j of fd(i, j') + (j - j'), from the cell left of the band on
+            j = j_begin;
+
+#ifdef __AVX2__
+            // lane l of a shift by n holds lane l - n, or inf in the first n lanes
+            auto shift = [&](const __m256i v, const int n, const __m256i order) {
+                const __m256i shifted = _mm256_permutevar8x32_epi32(v, _mm256_sub_epi32(order, _mm256_set1_epi32(n)));
+                return _mm256_blendv_epi8(shifted, inf_v, _mm256_cmpgt_epi32(_mm256_set1_epi32(n), order));
+            };
+            const __m256i order = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+            const __m256i steps = _mm256_add_epi32(order, one_v);
+
+            for (; j + 7 <= j_end; j += 8) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(current + j));
+                v = _mm256_min_epi32(v, _mm256_add_epi32(shift(v, 1, order), one_v));
+                v = _mm256_min_epi32(v, _mm256_add_epi32(shift(v, 2, order), _mm256_set1_epi32(2)));
+                v = _mm256_min_epi32(v, _mm256_add_epi32(shift(v, 4, order), _mm256_set1_epi32(4)));
+                v = _mm256_min_epi32(v, _mm256_add_epi32(_mm256_set1_epi32(current[j - 1]), steps));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(current + j), _mm256_min_epi32(v, inf_v));
+            }
+#endif
+
+            for (; j <= j_end; ++j) current[j] = std::min(current[j], current[j - 1] + 1);
+        }
+
+        // anything over budget isn't exact, and is never needed within it
+        const std::int32_t distance = row(x_size)[y_size];
+        return distance <= e ? distance : std::numeric_limits<double>::infinity();
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    double ForestDistance<CostModel, TreeIndex>::forest(const int i, const int j) const {
+
+        constexpr double none = std::numeric_limits<double>::infinity();
+
+        if (j < 0 || j > y_size_ || std::abs(i - j) > e_) return none;
+
+        const int width = 2 * e_ + 1;
+        if constexpr (UnitCost<CostModel>::value) {
+            const std::int32_t distance = rows_[static_cast<size_t>(i) * (width + 1) + (e_ - i) + j];
+            return distance < inf ? distance : none;
+        }
+        else return fd_[static_cast<size_t>(i) * width + (j - i + e_)];
+    }
+}
\ No newline at end of file
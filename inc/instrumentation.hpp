@@ -0,0 +1,98 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "instrumentation.fwd.hpp"
+
+#include <array>
+#include <chrono>
+#include <ostream>
+
+namespace ted {
+
+    // the phases of a revision that are timed
+    enum class Phase {
+        preprocess_ted, // t_old -> t_new, for either tree
+        extract_preserved,
+        init_matrices,
+        reuse_scan, // not counting the tree_dist calls it makes
+        tree_dist,
+        count
+    };
+
+    // Measurements of a single revision: nanoseconds per phase, log2 histograms of the subtree pair sizes
+    // recomputed and of the budgets they were recomputed with, and how much of the band was filled.
+    template <bool enabled>
+    class Instrumentation {
+
+        static constexpr int buckets = 32; // bucket b holds values in [2^(b-1), 2^b), bucket 0 holds 0
+
+        std::array<long long int, static_cast<int>(Phase::count)> nanos_ {};
+        std::array<long long int, buckets> sizes_ {};
+        std::array<long long int, buckets> budgets_ {};
+        long long int band_cells_ = 0;
+        long long int filled_cells_ = 0;
+
+        static int bucket(long long int value);
+
+    public:
+
+        using Stamp = std::chrono::steady_clock::time_point;
+
+        static Stamp now();
+
+        // adds the time since start to phase, less excluded nanoseconds spent in a nested phase
+        void add(const Phase phase, const Stamp start, const long long int excluded = 0);
+
+        long long int total(const Phase phase) const;
+
+        // a subtree pair of the given combined size, recomputed within budget
+        void recomputed(const int size, const int budget);
+
+        // a band row of cells, of which filled were reused or recomputed
+        void band(const int cells, const int filled);
+
+        // adds everything measured by other, e.g. preprocessing done on another thread
+        void merge(const Instrumentation& other);
+
+        void reset();
+
+        // the measurements as the members of a JSON object, for the caller to wrap
+        void write(std::ostream& out) const;
+    };
+
+    // with instrumentation compiled out every call is empty and inlined away
+    template <>
+    class Instrumentation<false> {
+    public:
+        struct Stamp {};
+        static Stamp now() { return {}; }
+        void add(const Phase, const Stamp, const long long int = 0) {}
+        long long int total(const Phase) const { return 0; }
+        void recomputed(const int, const int) {}
+        void band(const int, const int) {}
+        void merge(const Instrumentation&) {}
+        void reset() {}
+        void write(std::ostream&) const {}
+    };
+}
+
+#include "instrumentation.imp.hpp"
\ No newline at end of file
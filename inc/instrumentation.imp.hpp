@@ -0,0 +1,100 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "instrumentation.hpp"
+
+#include <algorithm>
+#include <bit>
+
+namespace ted {
+
+    template <bool enabled>
+    int Instrumentation<enabled>::bucket(long long int value) {
+        return std::min<int>(std::bit_width(static_cast<unsigned long long int>(std::max(0LL, value))), buckets - 1);
+    }
+
+    template <bool enabled>
+    typename Instrumentation<enabled>::Stamp Instrumentation<enabled>::now() {
+        return std::chrono::steady_clock::now();
+    }
+
+    template <bool enabled>
+    void Instrumentation<enabled>::add(const Phase phase, const Stamp start, const long long int excluded) {
+        nanos_[static_cast<int>(phase)] += std::chrono::duration_cast<std::chrono::nanoseconds>(now() - start).count() - excluded;
+    }
+
+    template <bool enabled>
+    long long int Instrumentation<enabled>::total(const Phase phase) const {
+        return nanos_[static_cast<int>(phase)];
+    }
+
+    template <bool enabled>
+    void Instrumentation<enabled>::recomputed(const int size, const int budget) {
+        sizes_[bucket(size)]++;
+        budgets_[bucket(budget)]++;
+    }
+
+    template <bool enabled>
+    void Instrumentation<enabled>::band(const int cells, const int filled) {
+        band_cells_ += cells;
+        filled_cells_ += filled;
+    }
+
+    template <bool enabled>
+    void Instrumentation<enabled>::merge(const Instrumentation& other) {
+        for (size_t i = 0; i < nanos_.size(); ++i) nanos_[i] += other.nanos_[i];
+        for (int b = 0; b < buckets; ++b) {
+            sizes_[b] += other.sizes_[b];
+            budgets_[b] += other.budgets_[b];
+        }
+        band_cells_ += other.band_cells_;
+        filled_cells_ += other.filled_cells_;
+    }
+
+    template <bool enabled>
+    void Instrumentation<enabled>::reset() {
+        *this = Instrumentation();
+    }
+
+    template <bool enabled>
+    void Instrumentation<enabled>::write(std::ostream& out) const {
+
+        constexpr const char* phases[] = { "preprocess_ted", "extract_preserved", "init_matrices", "reuse_scan", "tree_dist" };
+
+        // histograms are trimmed after their last non-empty bucket
+        auto histogram = [&](const char* name, const std::array<long long int, buckets>& counts) {
+            int used = buckets;
+            while (used > 0 && counts[used - 1] == 0) --used;
+            out << ", \"" << name << "\": [";
+            for (int b = 0; b < used; ++b) out << (b ? ", " : "") << counts[b];
+            out << "]";
+        };
+
+        out << "\"nanos\": {";
+        for (size_t i = 0; i < nanos_.size(); ++i) out << (i ? ", " : "") << "\"" << phases[i] << "\": " << nanos_[i];
+        out << "}";
+        histogram("recomputed_sizes", sizes_);
+        histogram("recomputed_budgets", budgets_);
+        out << ", \"band_cells\": " << band_cells_ << ", \"filled_cells\": " << filled_cells_;
+        out << ", \"fill_ratio\": " << (band_cells_ ? static_cast<double>(filled_cells_) / band_cells_ : 0.0);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "lazy-band.fwd.hpp"
+#include "forest-distance.hpp"
+
+#include "matrix.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace ted {
+
+    // Evaluates a band top-down rather than sweeping it: the roots' forest distance is computed first, and
+    // each subtree pair it reads is only resolved then, computing its own forest distance in turn, and
+    // memoised in td. A pair that's known already (retained from the last revision) is read without
+    // descending into it at all, so the pairs inside large unchanged regions are never touched.
+    // Under UnitCost, a pair isn't read either where any mapping through it is certainly over budget: the
+    // forest distance before it, its size difference and the size difference of the forests left after it
+    // already add up to more. Other cost models read every pair in the band.
+    // Cell values are the same as a sweep would compute; cells never resolved are left infinite.
+    // Every pair resolved nests inside the one that read it, so evaluation recurses up to the two trees'
+    // heights together and keeps a forest matrix of up to |t1| * (2k + 1) cells per level: only pairs that
+    // fit within max_depth are evaluated this way, and callers sweep the band of any other.
+    template <typename CostModel, typename TreeIndex>
+    class LazyBand {
+
+        std::vector<std::vector<double>> fd_; // banded by row, one per nesting depth, grown on demand
+        // band cells by row, stamped with the pass that resolved them, so that a pass starts with none resolved
+        // without clearing them; only grown, and only cleared when the stamps wrap around
+        std::vector<std::uint32_t> resolved_;
+        std::uint32_t pass_ = 0;
+
+    public:
+
+        static constexpr int max_depth = 512;
+
+        // whether t1 and t2 nest shallowly enough for evaluate
+        static bool fits(const TreeIndex& t1, const TreeIndex& t2);
+
+        // of the last evaluate
+        long long int hit = 0; // pairs read from retained
+        long long int missed = 0; // pairs computed
+
+        // Returns td of the roots within k, computing each pair it reads with budget(x, y) (negative if it's
+        // never needed within k, in which case it's infinite) unless retained(x, y) has it (NaN if not).
+        // Forest pairs computed are counted in subproblems.
+        template <typename Retained, typename Budget>
+        double evaluate(
+            const CostModel& c, const TreeIndex& t1, const TreeIndex& t2, data_structures::BandMatrix<double>& td,
+            const int k, Retained&& retained, Budget&& budget, long long int& subproblems
+        );
+    };
+}
+
+#include "lazy-band.imp.hpp"
\ No newline at end of file
@@ -0,0 +1,144 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "lazy-band.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <limits>
+
+namespace ted {
+
+    template <typename CostModel, typename TreeIndex>
+    bool LazyBand<CostModel, TreeIndex>::fits(const TreeIndex& t1, const TreeIndex& t2) {
+        // the roots' subtree max depth is each tree's height, and a nested pair is deeper in one tree at least
+        const int t1_height = t1.postl_to_subtree_max_depth_[t1.tree_size_ - 1];
+        const int t2_height = t2.postl_to_subtree_max_depth_[t2.tree_size_ - 1];
+        return t1_height + t2_height + 1 <= max_depth;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    template <typename Retained, typename Budget>
+    double LazyBand<CostModel, TreeIndex>::evaluate(
+        const CostModel& c, const TreeIndex& t1, const TreeIndex& t2, data_structures::BandMatrix<double>& td,
+        const int k, Retained&& retained, Budget&& budget, long long int& subproblems
+    ) {
+        constexpr double inf = std::numeric_limits<double>::infinity();
+
+        const int t1_size = t1.tree_size_;
+        const int t2_size = t2.tree_size_;
+
+        hit = 0;
+        missed = 0;
+
+        if (std::abs(t1_size - t2_size) > k) return inf;
+
+        const size_t band = 2 * static_cast<size_t>(k) + 1;
+        if (resolved_.size() < static_cast<size_t>(t1_size) * band) resolved_.resize(static_cast<size_t>(t1_size) * band, 0);
+        if (++pass_ == 0) {
+            std::fill(resolved_.begin(), resolved_.end(), 0);
+            pass_ = 1;
+        }
+
+        // the forest distance behind td(x, y) with budget e, as ForestDistance::generic, but reading pairs
+        // through cell; depth picks the scratch, since every pair read may compute one of its own
+        auto tree_dist = [&](auto& cell, const int x, const int y, const int e, const size_t depth) {
+
+            const int x_size = t1.postl_to_size_[x];
+            const int y_size = t2.postl_to_size_[y];
+
+            if (e < 0 || std::abs(x_size - y_size) > e) return inf;
+
+            const int x_off = x - x_size;
+            const int y_off = y - y_size;
+
+            const int width = 2 * e + 1;
+            if (fd_.size() <= depth) fd_.resize(depth + 1);
+            const size_t needed = static_cast<size_t>(x_size + 1) * width;
+            if (fd_[depth].size() < needed) fd_[depth].resize(needed);
+
+            // scratch may move while a nested pair grows fd_, so it's looked up again on every access
+            auto fd = [&](const int i, const int j) -> double& { return fd_[depth][static_cast<size_t>(i) * width + (j - i + e)]; };
+            auto read = [&](const int i, const int j) { return (j < 0 || j > y_size || std::abs(i - j) > e) ? inf : fd(i, j); };
+
+            fd(0, 0) = 0;
+            for (int j = 1; j <= std::min(y_size, e); ++j) fd(0, j) = fd(0, j - 1) + c.ins(t2.postl_to_label_id_[j + y_off]);
+
+            for (int i = 1; i <= x_size; ++i) {
+
+                const int x_label = t1.postl_to_label_id_[i + x_off];
+                const int i_lld = t1.postl_to_lld_[i + x_off] - x_off;
+
+                if (i <= e) fd(i, 0) = fd(i - 1, 0) + c.del(x_label);
+
+                for (int j = std::max(1, i - e); j <= std::min(y_size, i + e); ++j) {
+
+                    subproblems++;
+
+                    const int y_label = t2.postl_to_label_id_[j + y_off];
+                    const int j_lld = t2.postl_to_lld_[j + y_off] - y_off;
+
+                    double distance = std::min(read(i - 1, j) + c.del(x_label), read(i, j - 1) + c.ins(y_label));
+
+                    if (i_lld == 1 && j_lld == 1) distance = std::min(distance, read(i - 1, j - 1) + c.ren(x_label, y_label));
+                    else {
+                        const double before = read(i_lld - 1, j_lld - 1);
+                        bool needed = before <= e;
+                        if constexpr (UnitCost<CostModel>::value) {
+                            needed = before + std::abs((i - i_lld) - (j - j_lld)) + std::abs((x_size - i) - (y_size - j)) <= e;
+                        }
+                        if (needed) distance = std::min(distance, before + cell(cell, i + x_off, j + y_off, depth + 1));
+                    }
+
+                    fd(i, j) = distance;
+                }
+            }
+
+            const double distance = fd(x_size, y_size);
+            return distance <= e ? distance : inf;
+        };
+
+        auto cell = [&](auto& self, const int x, const int y, const size_t depth) -> double {
+
+            if (std::abs(x - y) > k) return inf;
+
+            auto& resolved = resolved_[static_cast<size_t>(x) * band + (y - x + k)];
+            if (resolved == pass_) return td.at(x, y);
+            resolved = pass_;
+
+            double distance = retained(x, y);
+            if (!std::isnan(distance)) hit++;
+            else {
+                const int e = budget(x, y);
+                distance = e < 0 ? inf : tree_dist(self, x, y, e, depth);
+                if (e >= 0) missed++;
+            }
+
+            td.at(x, y) = distance;
+            return distance;
+        };
+
+        return cell(cell, t1_size - 1, t2_size - 1, 0);
+    }
+}
\ No newline at end of file
@@ -21,4 +21,10 @@
 
 #pragma once
 
-namespace parser {}
\ No newline at end of file
+namespace parser {
+
+    class MappedFile;
+
+    template <typename Label>
+    class LabelInterner;
+}
\ No newline at end of file
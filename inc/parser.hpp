@@ -23,20 +23,96 @@
 #include "parser.fwd.hpp"
 
 #include "node.h"
+#include "label_dictionary.h"
+#include "tree-update.hpp"
 
 #include <cstddef>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <functional>
+#include <optional>
+#include <ostream>
 #include <unordered_map>
+#include <vector>
 
 namespace parser {
 
+    // Binary edit script, all integers little-endian u32, nodes addressed by old prel:
+    //   'I' parent position node*   insert a subtree, its nodes in preorder
+    //   'D' root                    delete a subtree
+    //   'R' node length bytes       relabel a node
+    // where node := size length bytes, size being the number of nodes in that node's subtree.
+    // Every old prel must fall within the old tree's old_size nodes, and the root cannot be deleted;
+    // malformed scripts throw std::runtime_error with the byte offset of the fault.
     template <typename Label>
-    node::Node<Label> parse(const std::string& source);
+    std::vector<update::Edit<Label>> parse_edits(std::string_view source, size_t old_size);
 
+    // A recorded benchmark run (see bench.py --record), all integers little-endian u32:
+    //   length bytes                   tree 1, bracket notation
+    //   length bytes                   tree 2, bracket notation
+    //   (length bytes length bytes)*   per step, the edit scripts of tree 1 and tree 2
+    // where a length of 0xFFFFFFFF, with no bytes, marks a tree that step leaves unchanged.
+    // Views point into the source.
+    struct Replay {
+        std::string_view t1;
+        std::string_view t2;
+        std::vector<std::pair<std::optional<std::string_view>, std::optional<std::string_view>>> steps;
+    };
+
+    Replay parse_replay(std::string_view source);
+
+    // Read-only memory map of a whole file. Read eagerly and sequentially, unless lazy, in which case
+    // pages are only read in as they're touched.
+    class MappedFile {
+
+        void* data_;
+        size_t size_;
+
+    public:
+
+        MappedFile(const std::string& path, const bool lazy = false);
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        ~MappedFile();
+
+        std::string_view view() const;
+    };
+
+    // Fronts a LabelDictionary so that labels can be looked up straight from the source text. Only a
+    // label's first occurrence constructs a Label.
     template <typename Label>
-    std::pair<node::Node<Label>, std::unordered_map<size_t, size_t>> parse(const std::string& source, std::function<Label(size_t)> label_lookup);
+    class LabelInterner {
+
+        struct Hash {
+            using is_transparent = void;
+            size_t operator()(std::string_view label) const { return std::hash<std::string_view>()(label); }
+        };
+
+        label::LabelDictionary<Label>& labels_;
+        std::unordered_map<std::string, int, Hash, std::equal_to<>> ids_;
+
+    public:
+
+        LabelInterner(label::LabelDictionary<Label>& labels);
+
+        int intern(std::string_view label);
+    };
+
+    // Streams the bracket notation tree in source into an update:: builder, with no node::Node tree and
+    // no temporary strings. Labels omitted from retained nodes are taken from old_prel_to_label_id.
+    // Returns the preserved-node map (new_prel -> old_prel) given by the [index] markers. Malformed input
+    // throws std::runtime_error, giving the byte offset it was found at.
+    template <typename Builder, typename Label>
+    std::unordered_map<size_t, size_t> parse_into(
+        std::string_view source, Builder& builder,
+        LabelInterner<Label>& labels,
+        const std::vector<int>& old_prel_to_label_id = {}
+    );
+
+    // Writes an indexed tree in the bracket notation parse_into reads, with every label given.
+    template <typename TreeIndex, typename Label>
+    void write_bracket(std::ostream& out, const TreeIndex& t, const label::LabelDictionary<Label>& labels);
 }
 
 #include "parser.imp.hpp"
\ No newline at end of file
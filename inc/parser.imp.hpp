@@ -23,122 +23,277 @@
 #include "parser.hpp"
 
 #include <vector>
+#include <string>
 #include <optional>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <charconv>
+#include <limits>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace parser {
 
     template <typename Label>
-    node::Node<Label> parse(const std::string& source) {
-
-        std::vector<std::reference_wrapper<node::Node<Label>>> stack;
+    std::vector<update::Edit<Label>> parse_edits(std::string_view source, const size_t old_size) {
 
-        std::string::const_iterator label_begin = source.begin();
-        std::optional<Label> label;
+        std::vector<update::Edit<Label>> edits;
 
         auto it = source.begin();
 
-        do {
-            /// TODO: handoff to Label parser here
-            if (*it == '(') {
-                label_begin = std::next(it);
-            }
-            else if (*it == ')') {
-                label = std::make_optional(Label(std::string(label_begin, it)));
-            }
-        } while (*(++it) != '{');
+        auto error = [&](const std::string& what, std::string_view::iterator at) {
+            return std::runtime_error(what + " at byte " + std::to_string(at - source.begin()));
+        };
 
-        node::Node<Label> root(label.value());
-        stack.push_back(std::ref(root));
+        auto read_u32 = [&]() {
+            if (source.end() - it < 4) throw error("truncated edit script", it);
+            uint32_t value;
+            std::memcpy(&value, &*it, sizeof(value));
+            it += sizeof(value);
+            return static_cast<size_t>(value);
+        };
 
-        while (++it != source.end()) {
-            if (*it == '(') {
-                label_begin = std::next(it);
-                while (*(++it) != ')');
-                label = std::make_optional(Label(std::string(label_begin, it)));
-            }
-            else if (*it == '{') {
-                stack.push_back(std::ref(stack.back().get().add_child(node::Node(label.value()))));
-                label.reset();
+        // a stale or corrupt script would otherwise write past the old tree's nodes
+        auto read_node = [&]() {
+            const auto at = it;
+            const size_t node = read_u32();
+            if (node >= old_size) throw error("node " + std::to_string(node) + " beyond the previous revision", at);
+            return node;
+        };
+
+        auto read_label = [&]() {
+            const size_t length = read_u32();
+            if (static_cast<size_t>(source.end() - it) < length) throw error("truncated edit script", it);
+            auto label_begin = it;
+            it += length;
+            return Label(std::string(label_begin, it));
+        };
+
+        // returns the number of nodes consumed
+        auto read_subtree = [&](auto& self, node::Node<Label>& parent) -> size_t {
+            const size_t size = read_u32();
+            auto& child = parent.add_child(node::Node<Label>(read_label()));
+            for (size_t read = 1; read < size;) read += self(self, child);
+            return size;
+        };
+
+        while (it != source.end()) {
+            switch (*it++) {
+                case 'I': {
+                    const size_t parent = read_node();
+                    const size_t position = read_u32();
+                    const size_t size = read_u32();
+                    node::Node<Label> subtree(read_label());
+                    for (size_t read = 1; read < size;) read += read_subtree(read_subtree, subtree);
+                    edits.emplace_back(std::in_place_type<update::SubtreeInsertion<Label>>, parent, position, std::move(subtree));
+                    break;
+                }
+                case 'D': {
+                    const auto at = it;
+                    const size_t root = read_node();
+                    if (root == 0) throw error("deletion of the root", at);
+                    edits.emplace_back(std::in_place_type<update::SubtreeDeletion>, root);
+                    break;
+                }
+                case 'R': {
+                    const size_t node = read_node();
+                    edits.emplace_back(std::in_place_type<update::Relabel<Label>>, node, read_label());
+                    break;
+                }
+                default:
+                    throw error("unknown edit script operation", it - 1);
             }
-            else if (*it == '}') {
-                stack.pop_back();
+        }
+
+        return edits;
+    }
+
+    inline Replay parse_replay(std::string_view source) {
+
+        constexpr uint32_t unchanged = 0xFFFFFFFF;
+
+        auto it = source.begin();
+
+        auto read_u32 = [&]() {
+            if (source.end() - it < 4) throw std::runtime_error("truncated replay");
+            uint32_t value;
+            std::memcpy(&value, &*it, sizeof(value));
+            it += sizeof(value);
+            return value;
+        };
+
+        auto read_bytes = [&]() -> std::optional<std::string_view> {
+            const uint32_t length = read_u32();
+            if (length == unchanged) return std::nullopt;
+            if (static_cast<size_t>(source.end() - it) < length) throw std::runtime_error("truncated replay");
+            auto bytes = source.substr(it - source.begin(), length);
+            it += length;
+            return bytes;
+        };
+
+        Replay replay;
+
+        auto t1 = read_bytes();
+        auto t2 = read_bytes();
+        if (!t1.has_value() || !t2.has_value()) throw std::runtime_error("replay is missing a baseline tree");
+        replay.t1 = t1.value();
+        replay.t2 = t2.value();
+
+        while (it != source.end()) {
+            auto t1_script = read_bytes();
+            replay.steps.emplace_back(t1_script, read_bytes());
+        }
+
+        return replay;
+    }
+
+    inline MappedFile::MappedFile(const std::string& path, const bool lazy) : data_(nullptr), size_(0) {
+
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::system_error(errno, std::generic_category(), path);
+
+        struct stat status;
+        if (::fstat(fd, &status) == 0) size_ = status.st_size;
+
+        if (size_) {
+            data_ = ::mmap(nullptr, size_, PROT_READ, lazy ? MAP_PRIVATE : MAP_PRIVATE | MAP_POPULATE, fd, 0);
+            if (data_ == MAP_FAILED) {
+                data_ = nullptr;
+                ::close(fd);
+                throw std::system_error(errno, std::generic_category(), path);
             }
+            ::madvise(data_, size_, lazy ? MADV_RANDOM : MADV_SEQUENTIAL);
         }
 
-        return root;
+        ::close(fd);
+    }
+
+    inline MappedFile::~MappedFile() {
+        if (data_) ::munmap(data_, size_);
+    }
+
+    inline std::string_view MappedFile::view() const {
+        return std::string_view(static_cast<const char*>(data_), size_);
     }
 
     template <typename Label>
-    std::pair<node::Node<Label>, std::unordered_map<size_t, size_t>> parse(const std::string& source, std::function<Label(size_t)> label_lookup) {
+    LabelInterner<Label>::LabelInterner(label::LabelDictionary<Label>& labels) : labels_(labels) {}
+
+    template <typename Label>
+    int LabelInterner<Label>::intern(std::string_view label) {
+        auto it = ids_.find(label);
+        if (it != ids_.end()) return it->second;
+        std::string owned(label);
+        const int id = labels_.insert(Label(owned));
+        ids_.emplace(std::move(owned), id);
+        return id;
+    }
 
-        std::vector<std::reference_wrapper<node::Node<Label>>> stack;
+    template <typename Builder, typename Label>
+    std::unordered_map<size_t, size_t> parse_into(
+        std::string_view source, Builder& builder,
+        LabelInterner<Label>& labels,
+        const std::vector<int>& old_prel_to_label_id
+    ) {
         std::unordered_map<size_t, size_t> retain;
 
-        std::string::const_iterator slice_begin = source.begin();
-        size_t new_index = 0;
-        std::optional<size_t> old_index;
+        // every node opens exactly one brace
+        builder.reserve(std::count(source.begin(), source.end(), '{'));
 
-        std::optional<Label> label;
+        const char* it = source.data();
+        const char* const end = it + source.size();
 
-        auto it = source.begin();
+        constexpr size_t no_index = std::numeric_limits<size_t>::max();
+        constexpr int no_label = -1;
 
-        do {
-            /// TODO: handoff to Label parser in here
-            if (*it == '[') {
-                slice_begin = std::next(it);
-            }
-            else if (*it == ']') {
-                old_index = std::stoull(std::string(slice_begin, it));
-            }
-            else if (*it == '(') {
-                slice_begin = std::next(it);
-            }
-            else if (*it == ')') {
-                label = Label(std::string(slice_begin, it));
-            }
-        } while (*(++it) != '{');
+        size_t old_index = no_index;
+        int label_id = no_label;
 
-        if (old_index.has_value()) {
-            retain.emplace(new_index, old_index.value());
-            if (!label.has_value()) {
-                label = std::make_optional(label_lookup(old_index.value()));
-            }
-        }
+        int depth = 0;
+        bool has_root = false;
 
-        node::Node<Label> root(label.value());
-        stack.push_back(std::ref(root));
+        auto error = [&](const std::string& what, const char* at) {
+            return std::runtime_error(what + " at byte " + std::to_string(at - source.data()));
+        };
 
-        old_index.reset();
-        label.reset();
+        // memchr is vectorised, which keeps long labels close to memory bandwidth
+        auto find = [&](const char* from, char delimiter) {
+            auto found = static_cast<const char*>(std::memchr(from, delimiter, end - from));
+            if (!found) throw error(std::string("missing '") + delimiter + "'", from - 1);
+            return found;
+        };
 
-        while (++it != source.end()) {
-            if (*it == '[') {
-                slice_begin = std::next(it);
-                while (*(++it) != ']');
-                old_index = std::make_optional(std::stoull(std::string(slice_begin, it)));
-            }
-            else if (*it == '(') {
-                slice_begin = std::next(it);
-                while (*(++it) != ')');
-                label = std::make_optional(Label(std::string(slice_begin, it)));
-            }
-            else if (*it == '{') {
-                new_index++;
-                if (old_index.has_value()) {
-                    retain.emplace(new_index, old_index.value());
-                    if (!label.has_value()) {
-                        label = std::make_optional(label_lookup(old_index.value()));
+        while (it != end) {
+            switch (*it) {
+                case '[': {
+                    const char* index_end = find(++it, ']');
+                    const auto [index_parsed, ec] = std::from_chars(it, index_end, old_index);
+                    if (ec != std::errc() || index_parsed != index_end || old_index == no_index) throw error("malformed node index", it);
+                    it = index_end + 1;
+                    break;
+                }
+                case '(': {
+                    const char* label_end = find(++it, ')');
+                    label_id = labels.intern(std::string_view(it, label_end - it));
+                    it = label_end + 1;
+                    break;
+                }
+                case '{': {
+                    if (depth == 0 && has_root) throw error("second root", it);
+                    if (old_index != no_index && !old_prel_to_label_id.empty() && old_index >= old_prel_to_label_id.size()) {
+                        throw error("node index " + std::to_string(old_index) + " beyond the previous revision", it);
                     }
+                    if (label_id == no_label) {
+                        if (old_index == no_index || old_prel_to_label_id.empty()) throw error("node with neither a label nor an index into the previous revision", it);
+                        label_id = old_prel_to_label_id[old_index];
+                    }
+                    const int new_index = builder.open(label_id);
+                    if (old_index != no_index) retain.emplace(new_index, old_index);
+                    old_index = no_index;
+                    label_id = no_label;
+                    has_root = true;
+                    ++depth;
+                    ++it;
+                    break;
                 }
-                stack.push_back(std::ref(stack.back().get().add_child(node::Node(label.value()))));
-                old_index.reset();
-                label.reset();
-            }
-            else if (*it == '}') {
-                stack.pop_back();
+                case '}':
+                    if (depth == 0) throw error("'}' with no open node", it);
+                    builder.close();
+                    --depth;
+                    ++it;
+                    break;
+                default:
+                    ++it;
             }
         }
 
-        return std::pair{ root, retain };
+        if (!has_root) throw error("no tree", it);
+        if (depth > 0) throw error("unterminated node", it);
+
+        builder.finish();
+
+        return retain;
+    }
+
+    template <typename TreeIndex, typename Label>
+    void write_bracket(std::ostream& out, const TreeIndex& t, const label::LabelDictionary<Label>& labels) {
+
+        // the prel at which each open subtree ends
+        std::vector<int> ends;
+
+        for (int prel = 0; prel < t.tree_size_; ++prel) {
+            out << '(' << labels.get(t.prel_to_label_id_[prel]).to_string() << "){";
+            ends.push_back(prel + t.prel_to_size_[prel]);
+            while (!ends.empty() && ends.back() == prel + 1) {
+                out << '}';
+                ends.pop_back();
+            }
+        }
     }
 }
\ No newline at end of file
@@ -0,0 +1,162 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+#include "retained-band.fwd.hpp"
+
+#include "matrix.h"
+#include "unit_cost_model.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace ted {
+
+    // The value type td_old_ is kept in between revisions. Anything with costs that aren't small
+    // integers keeps doubles; wide is what's kept instead when type can't hold every distance.
+    template <typename CostModel>
+    struct RetainedValue {
+        using type = double;
+        using wide = double;
+    };
+
+    // unit costs make every distance an integer no larger than the sizes of both trees combined
+    template <typename Label>
+    struct RetainedValue<cost_model::UnitCostModelLD<Label>> {
+        using type = std::uint16_t;
+        using wide = std::uint32_t;
+    };
+
+    // A band matrix of the distances kept from one revision to the next, in Value rather than double.
+    // Cells never computed, and integer distances too large for Value, are both stored as not_computed
+    // and so are recomputed rather than reused.
+    // Each row holds a contiguous span of columns, initially the band, which retain can narrow or empty.
+    // The cells are either owned, or read in place from a mapped checkpoint (see ted::Checkpoint).
+    template <typename Value>
+    class RetainedBand {
+
+        struct Row {
+            size_t offset; // of column first in data_
+            int first;
+            int last; // first > last if the row is empty
+        };
+
+        std::vector<Value> data_;
+        std::vector<Row> rows_;
+        const Value* cells_ = nullptr; // data_, or the cells of a mapping
+        std::shared_ptr<const void> mapping_; // keeps the cells alive while they're mapped
+
+        size_t cells() const;
+        std::vector<int> columns_; // scratch for retain
+        std::vector<bool> keep_; // scratch for retain
+
+    public:
+
+        // where cells are aligned to in a saved band, so they start on a page of their own
+        static constexpr size_t alignment = 4096;
+
+        static constexpr Value not_computed = std::numeric_limits<Value>::has_infinity
+            ? std::numeric_limits<Value>::infinity()
+            : std::numeric_limits<Value>::max();
+
+        RetainedBand() = default;
+        RetainedBand(RetainedBand&&) = default;
+        RetainedBand& operator=(RetainedBand&&) = default;
+        RetainedBand(const RetainedBand&) = delete; // cells_ may point into data_
+        RetainedBand& operator=(const RetainedBand&) = delete;
+
+        // keeps the cells of td within k of the diagonal, for a rows x columns problem
+        void assign(data_structures::BandMatrix<double>& td, const int rows, const int columns, const int k);
+
+        // keeps no cells at all, for a problem with this many rows
+        void clear(const int rows);
+
+        // Drops every row of an old t1 node that isn't preserved, and narrows each remaining row to the span
+        // of the old t2 nodes that are. The maps are new postl -> old postl, negative where not preserved,
+        // or nullptr to keep every row / column.
+        void retain(const std::vector<int>* t1_preserved_subtrees, const std::vector<int>* t2_preserved_subtrees);
+
+        // the span of columns held for row x
+        int first(const int x) const;
+        int last(const int x) const;
+
+        // row x is contiguous, so this also points at the cells (x, y + 1), (x, y + 2), ... up to last(x)
+        const Value* at(const int x, const int y) const;
+
+        // Writes the band in host byte order, assumed little-endian:
+        //   u64 rows (u64 offset i32 first i32 last)*
+        //   zero padding up to a multiple of alignment from the start of out
+        //   the cells, row after row
+        void save(std::ostream& out) const;
+
+        // Reads a band written by save for a rows x columns problem from data, part of a mapping from base to
+        // end, without copying the cells; owner keeps the mapping alive for as long as they're used. Returns
+        // the end of the band, or throws std::runtime_error if it's truncated, has another number of rows, or
+        // has a row outside the columns or outside its cells.
+        const char* load(
+            const int rows, const int columns,
+            const char* data, const char* base, const char* end, std::shared_ptr<const void> owner
+        );
+    };
+
+    // A RetainedBand of Value for problems whose every distance fits in one, and of Wide for those too large
+    // for it; assign picks between them, from the size of the problem. Readers visit whichever is in use.
+    template <typename Value, typename Wide>
+    class AdaptiveRetainedBand {
+
+        RetainedBand<Value> narrow_;
+        RetainedBand<Wide> wide_;
+        bool is_wide_ = false;
+
+    public:
+
+        // whether a band saved with cells of value_size bytes can be loaded
+        static constexpr bool holds(const size_t value_size) {
+            return value_size == sizeof(Value) || value_size == sizeof(Wide);
+        }
+
+        // see RetainedBand
+        void assign(data_structures::BandMatrix<double>& td, const int rows, const int columns, const int k);
+        void clear(const int rows);
+        void retain(const std::vector<int>* t1_preserved_subtrees, const std::vector<int>* t2_preserved_subtrees);
+        void save(std::ostream& out) const;
+
+        // calls visitor with the RetainedBand in use
+        template <typename Visitor>
+        decltype(auto) visit(Visitor&& visitor) const;
+
+        // sizeof a cell of the RetainedBand in use
+        size_t value_size() const;
+
+        // RetainedBand::load, into the band whose cells are value_size bytes, which holds must allow
+        const char* load(
+            const size_t value_size, const int rows, const int columns,
+            const char* data, const char* base, const char* end, std::shared_ptr<const void> owner
+        );
+    };
+}
+
+#include "retained-band.imp.hpp"
\ No newline at end of file
@@ -0,0 +1,260 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+#include "retained-band.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace ted {
+
+    template <typename Value>
+    size_t RetainedBand<Value>::cells() const {
+        // rows are laid out in order, so the last one ends the cells
+        return rows_.empty() ? 0 : rows_.back().offset + std::max(0, rows_.back().last - rows_.back().first + 1);
+    }
+
+    template <typename Value>
+    void RetainedBand<Value>::assign(data_structures::BandMatrix<double>& td, const int rows, const int columns, const int k) {
+
+        rows_.resize(rows);
+
+        size_t size = 0;
+        for (int x = 0; x < rows; ++x) {
+            rows_[x] = { size, std::max(0, x - k), std::min(x + k, columns - 1) };
+            size += std::max(0, rows_[x].last - rows_[x].first + 1);
+        }
+
+        data_.assign(size, not_computed);
+        cells_ = data_.data();
+        mapping_.reset();
+
+        for (int x = 0; x < rows; ++x) {
+            Value* cell = &data_[rows_[x].offset];
+            for (int y = rows_[x].first; y <= rows_[x].last; ++y, ++cell) {
+                const double distance = td.read_at(x, y);
+                if constexpr (std::numeric_limits<Value>::has_infinity) *cell = distance;
+                else if (!std::isinf(distance) && distance < not_computed) *cell = static_cast<Value>(distance);
+            }
+        }
+    }
+
+    template <typename Value>
+    void RetainedBand<Value>::clear(const int rows) {
+        rows_.assign(rows, { 0, 0, -1 });
+        data_.clear();
+        cells_ = data_.data();
+        mapping_.reset();
+    }
+
+    template <typename Value>
+    void RetainedBand<Value>::retain(const std::vector<int>* t1_preserved_subtrees, const std::vector<int>* t2_preserved_subtrees) {
+
+        // mapped cells are read-only, so the spans kept are copied out of them rather than compacted in place,
+        // and the pages of the rows dropped are never read
+        const bool mapped = mapping_ != nullptr;
+        if (mapped) data_.clear();
+
+        keep_.assign(rows_.size(), t1_preserved_subtrees == nullptr);
+        if (t1_preserved_subtrees) {
+            for (int old_x : *t1_preserved_subtrees) if (old_x >= 0) keep_[old_x] = true;
+        }
+
+        columns_.clear();
+        if (t2_preserved_subtrees) {
+            for (int old_y : *t2_preserved_subtrees) if (old_y >= 0) columns_.push_back(old_y);
+            std::sort(columns_.begin(), columns_.end());
+        }
+
+        // rows only ever shrink and move towards the front, so they can be compacted in place
+        size_t size = 0;
+        for (int x = 0; x < static_cast<int>(rows_.size()); ++x) {
+
+            auto& row = rows_[x];
+
+            int first = row.first;
+            int last = keep_[x] ? row.last : first - 1;
+
+            if (t2_preserved_subtrees && first <= last) {
+                auto begin = std::lower_bound(columns_.begin(), columns_.end(), first);
+                auto end = std::upper_bound(begin, columns_.end(), last);
+                if (begin == end) last = first - 1;
+                else {
+                    first = *begin;
+                    last = *(end - 1);
+                }
+            }
+
+            if (first <= last) {
+                const Value* source = cells_ + row.offset + (first - row.first);
+                if (mapped) data_.insert(data_.end(), source, source + (last - first + 1));
+                else std::copy(source, source + (last - first + 1), data_.begin() + size);
+            }
+
+            row = { size, first, last };
+            size += std::max(0, last - first + 1);
+        }
+
+        data_.resize(size);
+        cells_ = data_.data();
+        mapping_.reset();
+    }
+
+    template <typename Value>
+    int RetainedBand<Value>::first(const int x) const {
+        return rows_[x].first;
+    }
+
+    template <typename Value>
+    int RetainedBand<Value>::last(const int x) const {
+        return rows_[x].last;
+    }
+
+    template <typename Value>
+    const Value* RetainedBand<Value>::at(const int x, const int y) const {
+        return cells_ + rows_[x].offset + (y - rows_[x].first);
+    }
+
+    template <typename Value>
+    void RetainedBand<Value>::save(std::ostream& out) const {
+
+        auto write = [&](auto value) { out.write(reinterpret_cast<const char*>(&value), sizeof(value)); };
+
+        write(static_cast<std::uint64_t>(rows_.size()));
+        for (const auto& row : rows_) {
+            write(static_cast<std::uint64_t>(row.offset));
+            write(static_cast<std::int32_t>(row.first));
+            write(static_cast<std::int32_t>(row.last));
+        }
+
+        const char padding[alignment] = {};
+        out.write(padding, (alignment - static_cast<size_t>(out.tellp()) % alignment) % alignment);
+
+        out.write(reinterpret_cast<const char*>(cells_), cells() * sizeof(Value));
+    }
+
+    template <typename Value>
+    const char* RetainedBand<Value>::load(
+        const int rows, const int columns,
+        const char* data, const char* base, const char* end, std::shared_ptr<const void> owner
+    ) {
+
+        auto read = [&](auto& value) {
+            if (end - data < static_cast<std::ptrdiff_t>(sizeof(value))) throw std::runtime_error("truncated retained band");
+            std::memcpy(&value, data, sizeof(value));
+            data += sizeof(value);
+        };
+
+        std::uint64_t saved_rows;
+        read(saved_rows);
+        if (saved_rows != static_cast<std::uint64_t>(rows)) throw std::runtime_error("retained band of another tree");
+        if (saved_rows > static_cast<std::uint64_t>(end - data) / 16) throw std::runtime_error("truncated retained band");
+
+        // rows are laid out in order, each within the columns, so that every cell read lies inside cells()
+        rows_.resize(rows);
+        size_t size = 0;
+        for (auto& row : rows_) {
+            std::uint64_t offset;
+            std::int32_t first, last;
+            read(offset);
+            read(first);
+            read(last);
+            if (offset != size || (first <= last && (first < 0 || last >= columns))) throw std::runtime_error("corrupt retained band");
+            row = { size, first, last };
+            size += std::max(0, last - first + 1);
+        }
+
+        data += (alignment - (data - base) % alignment) % alignment;
+        if (data > end || static_cast<size_t>(end - data) / sizeof(Value) < cells()) throw std::runtime_error("truncated retained band");
+
+        data_.clear();
+        cells_ = reinterpret_cast<const Value*>(data);
+        mapping_ = std::move(owner);
+
+        return data + cells() * sizeof(Value);
+    }
+
+    template <typename Value, typename Wide>
+    void AdaptiveRetainedBand<Value, Wide>::assign(data_structures::BandMatrix<double>& td, const int rows, const int columns, const int k) {
+
+        // deleting both trees entirely bounds every distance in the problem
+        is_wide_ = static_cast<double>(rows) + columns >= RetainedBand<Value>::not_computed;
+
+        if (is_wide_) {
+            wide_.assign(td, rows, columns, k);
+            narrow_.clear(0);
+        }
+        else {
+            narrow_.assign(td, rows, columns, k);
+            wide_.clear(0);
+        }
+    }
+
+    template <typename Value, typename Wide>
+    void AdaptiveRetainedBand<Value, Wide>::clear(const int rows) {
+        is_wide_ = false;
+        narrow_.clear(rows);
+        wide_.clear(0);
+    }
+
+    template <typename Value, typename Wide>
+    void AdaptiveRetainedBand<Value, Wide>::retain(const std::vector<int>* t1_preserved_subtrees, const std::vector<int>* t2_preserved_subtrees) {
+        if (is_wide_) wide_.retain(t1_preserved_subtrees, t2_preserved_subtrees);
+        else narrow_.retain(t1_preserved_subtrees, t2_preserved_subtrees);
+    }
+
+    template <typename Value, typename Wide>
+    void AdaptiveRetainedBand<Value, Wide>::save(std::ostream& out) const {
+        visit([&](const auto& band) { band.save(out); });
+    }
+
+    template <typename Value, typename Wide>
+    template <typename Visitor>
+    decltype(auto) AdaptiveRetainedBand<Value, Wide>::visit(Visitor&& visitor) const {
+        if (is_wide_) return visitor(wide_);
+        return visitor(narrow_);
+    }
+
+    template <typename Value, typename Wide>
+    size_t AdaptiveRetainedBand<Value, Wide>::value_size() const {
+        return is_wide_ ? sizeof(Wide) : sizeof(Value);
+    }
+
+    template <typename Value, typename Wide>
+    const char* AdaptiveRetainedBand<Value, Wide>::load(
+        const size_t value_size, const int rows, const int columns,
+        const char* data, const char* base, const char* end, std::shared_ptr<const void> owner
+    ) {
+        // a Value that's as wide as Wide is always narrow_
+        is_wide_ = value_size != sizeof(Value);
+
+        if (is_wide_) {
+            narrow_.clear(0);
+            return wide_.load(rows, columns, data, base, end, std::move(owner));
+        }
+        wide_.clear(0);
+        return narrow_.load(rows, columns, data, base, end, std::move(owner));
+    }
+}
\ No newline at end of file
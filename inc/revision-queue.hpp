@@ -0,0 +1,76 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "revision-queue.fwd.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace ted {
+
+    // Queues revisions as they arrive, so that a consumer that has fallen behind can take several at once
+    // and coalesce them into a single dynamic step (composing their preserved nodes with update::compose).
+    // The oldest revision is taken on its own while it's still within the latency target of arriving;
+    // once it isn't, every revision queued is taken together, so that the next distance published is for
+    // the newest revision rather than one further behind. Safe to push from one thread while another takes.
+    template <typename Revision>
+    class RevisionQueue {
+
+        using Clock = std::chrono::steady_clock;
+
+        struct Queued {
+            Revision revision;
+            Clock::time_point arrived;
+        };
+
+        std::mutex mutex_;
+        std::condition_variable queued_;
+        std::deque<Queued> queue_;
+        bool closed_ = false;
+
+    public:
+
+        const std::chrono::duration<double, std::milli> latency_target;
+
+        // of every take so far
+        long long int taken = 0; // revisions
+        long long int coalesced = 0; // revisions taken along with an older one, which are never computed on their own
+        double waited_millis = 0; // by the oldest revision of the last take, since it arrived
+
+        RevisionQueue(const double latency_target_millis);
+
+        void push(Revision revision);
+
+        // no more revisions will be pushed
+        void close();
+
+        // Blocks until a revision is queued, returning the revisions to compute next, oldest first: just
+        // the oldest, or all of them if it's waited longer than the latency target. Empty once the queue
+        // is closed and drained.
+        std::vector<Revision> take();
+    };
+}
+
+#include "revision-queue.imp.hpp"
\ No newline at end of file
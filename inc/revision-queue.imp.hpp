@@ -0,0 +1,74 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "revision-queue.hpp"
+
+#include <utility>
+
+namespace ted {
+
+    template <typename Revision>
+    RevisionQueue<Revision>::RevisionQueue(const double latency_target_millis) : latency_target(latency_target_millis) {}
+
+    template <typename Revision>
+    void RevisionQueue<Revision>::push(Revision revision) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back({ std::move(revision), Clock::now() });
+        }
+        queued_.notify_one();
+    }
+
+    template <typename Revision>
+    void RevisionQueue<Revision>::close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        queued_.notify_one();
+    }
+
+    template <typename Revision>
+    std::vector<Revision> RevisionQueue<Revision>::take() {
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        queued_.wait(lock, [&] { return closed_ || !queue_.empty(); });
+
+        std::vector<Revision> revisions;
+        if (queue_.empty()) return revisions;
+
+        waited_millis = std::chrono::duration<double, std::milli>(Clock::now() - queue_.front().arrived).count();
+
+        // behind: whatever is queued would only wait longer still behind the oldest
+        const size_t count = waited_millis > latency_target.count() ? queue_.size() : 1;
+
+        for (size_t revision = 0; revision < count; ++revision) {
+            revisions.push_back(std::move(queue_.front().revision));
+            queue_.pop_front();
+        }
+
+        taken += count;
+        coalesced += count - 1;
+
+        return revisions;
+    }
+}
\ No newline at end of file
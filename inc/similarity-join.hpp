@@ -0,0 +1,123 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "similarity-join.fwd.hpp"
+
+#include "dynamic-session.hpp"
+
+#include <cstddef>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ted {
+
+    // Maintains every pair of a collection of trees within a threshold of each other, as the trees are
+    // revised. Pairs are filtered by lower bounds held per tree (its size and label multiset; like the
+    // engine's k bounds, these assume unit costs), with trees indexed by size so a tree is only ever
+    // compared against those within the threshold of its own size. Pairs passing the filter are verified
+    // by a DynamicSession whose engine is bounded by the threshold, so once verified a pair is kept up to
+    // date from its retained band.
+    // A commit re-filters only the pairs of new or revised trees; a pair the filter rules out is dropped,
+    // along with its retained band.
+    template <typename CostModel, typename TreeIndex>
+    class SimilarityJoin {
+
+    public:
+
+        using Engine = typename DynamicSession<CostModel, TreeIndex>::Engine;
+
+    private:
+
+        struct Signature {
+            int size = 0;
+            std::vector<std::pair<int, int>> labels; // (label id, count), by label id
+        };
+
+        struct Tree {
+            Signature signature;
+            std::optional<Signature> staged;
+            bool added; // not joined yet
+            std::set<std::string> partners; // of its tracked pairs
+        };
+
+        DynamicSession<CostModel, TreeIndex> session_;
+        const double threshold_;
+
+        std::unordered_map<std::string, Tree> trees_;
+        std::map<int, std::set<std::string>> sizes_; // size -> trees, as of the last commit (or add)
+
+        std::map<std::string, std::pair<std::string, std::string>> pairs_; // tracked pair id -> (t1, t2)
+        std::map<std::pair<std::string, std::string>, double> matches_;
+
+        static Signature sign(const TreeIndex& t);
+
+        // max(|t1|, |t2|) less their common labels: every other node must be deleted, inserted or renamed
+        static int lower_bound(const Signature& t1, const Signature& t2);
+
+        static std::string pair_id(const std::string& t1, const std::string& t2);
+
+        Tree& find_tree(const std::string& id);
+
+    public:
+
+        // of the last commit
+        long long int candidates = 0; // pairs within the threshold by size
+        long long int filtered = 0; // of which ruled out by their label multisets
+        long long int verified = 0; // of which run through the engine...
+        long long int retained = 0; // ...from a retained band
+
+        SimilarityJoin(const CostModel& c, const double threshold);
+
+        // the engine's flags (adaptive_bound, ...) apply to every pair; its threshold is the join's
+        Engine& engine();
+
+        double threshold() const;
+
+        // the tree is joined against the others on the next commit
+        void add_tree(const std::string& id, TreeIndex index);
+
+        // stages the next revision of a tree, preprocessing it against the current one straight away
+        void revise_tree(const std::string& id, TreeIndex index, const std::unordered_map<size_t, size_t>& preserved_nodes);
+
+        // the current (last committed) revision
+        const TreeIndex& tree(const std::string& id) const;
+
+        // the preprocessing of the last revision staged
+        const typename Engine::Revision& revision(const std::string& id) const;
+
+        // re-filters and verifies the pairs of every new or revised tree, then makes the staged revisions
+        // current. Calls report(t1, t2, distance) for every pair that came within the threshold, changed
+        // distance within it, or left it (with a distance of infinity).
+        template <typename Report>
+        void commit(Report&& report);
+
+        // every pair within the threshold as of the last commit, (t1, t2) -> distance, with t1 < t2
+        const std::map<std::pair<std::string, std::string>, double>& matches() const;
+    };
+}
+
+#include "similarity-join.imp.hpp"
\ No newline at end of file
@@ -0,0 +1,232 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "similarity-join.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+
+namespace ted {
+
+    template <typename CostModel, typename TreeIndex>
+    SimilarityJoin<CostModel, TreeIndex>::SimilarityJoin(const CostModel& c, const double threshold) : session_(c), threshold_(threshold) {
+        session_.engine().threshold = threshold;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    typename SimilarityJoin<CostModel, TreeIndex>::Engine& SimilarityJoin<CostModel, TreeIndex>::engine() {
+        return session_.engine();
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    double SimilarityJoin<CostModel, TreeIndex>::threshold() const {
+        return threshold_;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    typename SimilarityJoin<CostModel, TreeIndex>::Signature SimilarityJoin<CostModel, TreeIndex>::sign(const TreeIndex& t) {
+
+        std::vector<int> label_ids(t.postl_to_label_id_.begin(), t.postl_to_label_id_.begin() + t.tree_size_);
+        std::sort(label_ids.begin(), label_ids.end());
+
+        Signature signature;
+        signature.size = t.tree_size_;
+        for (const int label_id : label_ids) {
+            if (!signature.labels.empty() && signature.labels.back().first == label_id) signature.labels.back().second++;
+            else signature.labels.emplace_back(label_id, 1);
+        }
+
+        return signature;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    int SimilarityJoin<CostModel, TreeIndex>::lower_bound(const Signature& t1, const Signature& t2) {
+
+        int common = 0;
+        auto t1_label = t1.labels.begin();
+        auto t2_label = t2.labels.begin();
+
+        while (t1_label != t1.labels.end() && t2_label != t2.labels.end()) {
+            if (t1_label->first < t2_label->first) ++t1_label;
+            else if (t2_label->first < t1_label->first) ++t2_label;
+            else common += std::min((t1_label++)->second, (t2_label++)->second);
+        }
+
+        return std::max(t1.size, t2.size) - common;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    std::string SimilarityJoin<CostModel, TreeIndex>::pair_id(const std::string& t1, const std::string& t2) {
+        // prefixed with the length of t1, so that no two pairs share an id
+        return std::to_string(t1.size()) + ":" + t1 + t2;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    typename SimilarityJoin<CostModel, TreeIndex>::Tree& SimilarityJoin<CostModel, TreeIndex>::find_tree(const std::string& id) {
+        auto tree = trees_.find(id);
+        if (tree == trees_.end()) throw std::runtime_error("Unknown tree: " + id);
+        return tree->second;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    void SimilarityJoin<CostModel, TreeIndex>::add_tree(const std::string& id, TreeIndex index) {
+        auto signature = sign(index);
+        session_.add_tree(id, std::move(index));
+
+        auto& tree = trees_[id];
+        tree.signature = std::move(signature);
+        tree.added = true;
+        sizes_[tree.signature.size].insert(id);
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    void SimilarityJoin<CostModel, TreeIndex>::revise_tree(
+        const std::string& id, TreeIndex index,
+        const std::unordered_map<size_t, size_t>& preserved_nodes // new_prel -> old_prel
+    ) {
+        auto& tree = find_tree(id);
+        auto signature = sign(index);
+        session_.revise_tree(id, std::move(index), preserved_nodes);
+        tree.staged = std::move(signature);
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    const TreeIndex& SimilarityJoin<CostModel, TreeIndex>::tree(const std::string& id) const {
+        return session_.tree(id);
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    const typename SimilarityJoin<CostModel, TreeIndex>::Engine::Revision& SimilarityJoin<CostModel, TreeIndex>::revision(const std::string& id) const {
+        return session_.revision(id);
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    template <typename Report>
+    void SimilarityJoin<CostModel, TreeIndex>::commit(Report&& report) {
+
+        constexpr double inf = std::numeric_limits<double>::infinity();
+
+        candidates = filtered = verified = retained = 0;
+
+        const int window = std::isinf(threshold_) ? std::numeric_limits<int>::max() : static_cast<int>(threshold_);
+
+        // the pairs are filtered on the revisions about to become current
+        std::vector<std::string> changed;
+        for (auto& [id, tree] : trees_) {
+            if (tree.staged.has_value()) {
+                auto bucket = sizes_.find(tree.signature.size);
+                bucket->second.erase(id);
+                if (bucket->second.empty()) sizes_.erase(bucket);
+
+                tree.signature = std::move(*tree.staged);
+                tree.staged.reset();
+                sizes_[tree.signature.size].insert(id);
+            }
+            else if (!tree.added) continue;
+            changed.push_back(id);
+        }
+        std::sort(changed.begin(), changed.end()); // so that reports come in a stable order
+
+        std::set<std::pair<std::string, std::string>> considered;
+        std::set<std::string> tracked; // in this commit, so computed from scratch
+
+        auto consider = [&](const std::string& a, const std::string& b) {
+
+            if (a == b) return;
+            auto [t1, t2] = std::minmax(a, b);
+            std::pair<std::string, std::string> key(t1, t2);
+            if (!considered.insert(key).second) return;
+
+            auto& t1_tree = trees_.at(t1);
+            auto& t2_tree = trees_.at(t2);
+            const std::string id = pair_id(t1, t2);
+            const bool tracking = pairs_.count(id);
+
+            if (std::abs(t1_tree.signature.size - t2_tree.signature.size) <= window) {
+                candidates++;
+                if (lower_bound(t1_tree.signature, t2_tree.signature) <= threshold_) {
+                    if (!tracking) {
+                        session_.track(id, t1, t2);
+                        pairs_.emplace(id, key);
+                        t1_tree.partners.insert(t2);
+                        t2_tree.partners.insert(t1);
+                        tracked.insert(id);
+                    }
+                    return;
+                }
+                filtered++;
+            }
+
+            if (!tracking) return;
+
+            session_.untrack(id);
+            pairs_.erase(id);
+            t1_tree.partners.erase(t2);
+            t2_tree.partners.erase(t1);
+
+            if (matches_.erase(key)) report(key.first, key.second, inf);
+        };
+
+        for (const auto& id : changed) {
+
+            const int size = trees_.at(id).signature.size;
+
+            for (auto bucket = sizes_.lower_bound(size - window); bucket != sizes_.end() && bucket->first - size <= window; ++bucket) {
+                for (const auto& other : bucket->second) consider(id, other);
+            }
+
+            // the pairs it was tracked in, which may since have drifted out of the size window
+            const std::vector<std::string> partners(trees_.at(id).partners.begin(), trees_.at(id).partners.end());
+            for (const auto& other : partners) consider(id, other);
+        }
+
+        session_.commit([&](const std::string& id, const Engine& engine) {
+
+            verified++;
+            if (!tracked.count(id)) retained++;
+
+            const auto& key = pairs_.at(id);
+            const double distance = engine.d_old_ <= threshold_ ? engine.d_old_ : inf;
+
+            auto match = matches_.find(key);
+            if (std::isinf(distance)) {
+                if (match == matches_.end()) return;
+                matches_.erase(match);
+            }
+            else if (match == matches_.end()) matches_.emplace(key, distance);
+            else if (match->second != distance) match->second = distance;
+            else return;
+
+            report(key.first, key.second, distance);
+        });
+
+        for (const auto& id : changed) trees_.at(id).added = false;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    const std::map<std::pair<std::string, std::string>, double>& SimilarityJoin<CostModel, TreeIndex>::matches() const {
+        return matches_;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "subtree-hash.fwd.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace ted {
+
+    // Merkle-style fingerprint of every subtree, by postl: a hash of the root's label id and of its
+    // children's fingerprints in order, so identical subtrees (labels and shape) share a fingerprint.
+    template <typename TreeIndex>
+    void subtree_hashes(const TreeIndex& t, std::vector<std::uint64_t>& hashes);
+
+    // Finds the subtrees one revision of a tree preserves from the last by fingerprint alone, in time
+    // linear in the two trees, rather than from node identities confirmed by a TED between them.
+    // Fingerprints are trusted as they are; a collision would need the roots' labels and sizes to
+    // match as well.
+    template <typename TreeIndex>
+    class SubtreeMatcher {
+
+        std::vector<std::uint64_t> old_hashes_, new_hashes_;
+
+        // Every old postl grouped by fingerprint, ascending within each bucket, and each bucket between a pair
+        // of sentinels (-1). A candidate is dropped once it's claimed or an ancestor of one, by linking it to
+        // its neighbours: below_ and above_ lead to the nearest candidate still in place either side, or to a
+        // sentinel, and are compressed as they're followed. So each is passed over at most a few times.
+        struct Bucket {
+            int begin; // index of its first candidate
+            int end;
+        };
+        std::unordered_map<std::uint64_t, Bucket> buckets_; // by fingerprint
+        std::vector<int> candidates_;
+        std::vector<int> below_, above_; // by index into candidates_
+        std::vector<int> position_; // old postl -> index into candidates_
+
+        static int follow(std::vector<int>& links, int at);
+        void drop(const int x);
+
+        static constexpr char unclaimed = 0;
+        static constexpr char claimed = 1;
+        static constexpr char above_claimed = 2; // an ancestor of a claimed subtree
+        std::vector<char> old_state_; // by old postl
+
+    public:
+
+        // fingerprints both trees, and returns whether they're identical
+        bool identical(const TreeIndex& t_old, const TreeIndex& t_new);
+
+        // new postl -> old postl, or not_preserved, for every node of a maximal new subtree that has an
+        // identical old subtree. Each old subtree is used at most once, and where there's a choice
+        // the closest by postl is used. Needs the fingerprints of the last call to identical.
+        void match(
+            const TreeIndex& t_old, const TreeIndex& t_new,
+            std::vector<int>& preserved_subtrees, const int not_preserved
+        );
+    };
+}
+
+#include "subtree-hash.imp.hpp"
\ No newline at end of file
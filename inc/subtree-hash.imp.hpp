@@ -0,0 +1,160 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "subtree-hash.hpp"
+
+#include <algorithm>
+
+namespace ted {
+
+    template <typename TreeIndex>
+    void subtree_hashes(const TreeIndex& t, std::vector<std::uint64_t>& hashes) {
+
+        // the splitmix64 finaliser
+        auto mix = [](std::uint64_t x) {
+            x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9;
+            x = (x ^ (x >> 27)) * 0x94D049BB133111EB;
+            return x ^ (x >> 31);
+        };
+
+        hashes.resize(t.tree_size_);
+
+        for (int x = 0; x < t.tree_size_; ++x) {
+            std::uint64_t hash = mix(static_cast<std::uint64_t>(t.postl_to_label_id_[x]) + 0x9E3779B97F4A7C15);
+            // children precede x in postorder, so they're visited last to first by skipping over each one's subtree
+            const int first = x - t.postl_to_size_[x];
+            for (int child = x - 1; child > first; child -= t.postl_to_size_[child]) {
+                hash = mix(hash * 0x9E3779B97F4A7C15 + hashes[child]); // not symmetric, unlike xor
+            }
+            hashes[x] = hash;
+        }
+    }
+
+    template <typename TreeIndex>
+    bool SubtreeMatcher<TreeIndex>::identical(const TreeIndex& t_old, const TreeIndex& t_new) {
+        subtree_hashes(t_old, old_hashes_);
+        subtree_hashes(t_new, new_hashes_);
+        return t_old.tree_size_ == t_new.tree_size_ && old_hashes_.back() == new_hashes_.back();
+    }
+
+    template <typename TreeIndex>
+    int SubtreeMatcher<TreeIndex>::follow(std::vector<int>& links, int at) {
+        // path halving
+        while (links[at] != at) {
+            links[at] = links[links[at]];
+            at = links[at];
+        }
+        return at;
+    }
+
+    template <typename TreeIndex>
+    void SubtreeMatcher<TreeIndex>::drop(const int x) {
+        const int at = position_[x];
+        below_[at] = at - 1;
+        above_[at] = at + 1;
+    }
+
+    template <typename TreeIndex>
+    void SubtreeMatcher<TreeIndex>::match(
+        const TreeIndex& t_old, const TreeIndex& t_new,
+        std::vector<int>& preserved_subtrees, const int not_preserved
+    ) {
+        preserved_subtrees.assign(t_new.tree_size_, not_preserved);
+
+        // sizes each bucket, lays them out, then fills them in ascending order
+        buckets_.clear();
+        for (int x = 0; x < t_old.tree_size_; ++x) buckets_[old_hashes_[x]].end++;
+        int next = 1;
+        for (auto& [hash, bucket] : buckets_) {
+            const int size = bucket.end;
+            bucket = { next, next };
+            next += size + 1;
+        }
+
+        candidates_.assign(next, -1);
+        position_.resize(t_old.tree_size_);
+        for (int x = 0; x < t_old.tree_size_; ++x) {
+            auto& bucket = buckets_[old_hashes_[x]];
+            position_[x] = bucket.end;
+            candidates_[bucket.end++] = x;
+        }
+
+        below_.resize(next);
+        above_.resize(next);
+        for (int at = 0; at < next; ++at) below_[at] = above_[at] = at;
+
+        old_state_.assign(t_old.tree_size_, unclaimed);
+
+        auto matches = [&](const int x, const int y) {
+            return t_old.postl_to_size_[x] == t_new.postl_to_size_[y]
+                && t_old.postl_to_label_id_[x] == t_new.postl_to_label_id_[y];
+        };
+
+        // in preorder, so that an ancestor is matched (and its descendants skipped) before its descendants
+        for (int prel = 0; prel < t_new.tree_size_;) {
+
+            const int y = t_new.prel_to_postl_[prel];
+            const int size = t_new.postl_to_size_[y];
+
+            auto found = buckets_.find(new_hashes_[y]);
+            if (found == buckets_.end()) {
+                ++prel;
+                continue;
+            }
+
+            // the closest candidate still in place either side of y; those passed over are fingerprint collisions
+            const auto [begin, end] = found->second;
+            const int split = std::lower_bound(candidates_.begin() + begin, candidates_.begin() + end, y) - candidates_.begin();
+            int below = follow(below_, split - 1);
+            int above = follow(above_, split);
+            int x = not_preserved;
+            while (candidates_[below] != -1 || candidates_[above] != -1) {
+                const bool take_above = candidates_[below] == -1 || (candidates_[above] != -1 && candidates_[above] - y < y - candidates_[below]);
+                const int candidate = candidates_[take_above ? above : below];
+                if (matches(candidate, y)) {
+                    x = candidate;
+                    break;
+                }
+                if (take_above) above = follow(above_, above + 1);
+                else below = follow(below_, below - 1);
+            }
+
+            if (x == not_preserved) {
+                ++prel;
+                continue;
+            }
+
+            // identical subtrees have identical postorders
+            for (int offset = 0; offset < size; ++offset) {
+                preserved_subtrees[y - offset] = x - offset;
+                old_state_[x - offset] = claimed;
+                drop(x - offset);
+            }
+            for (int parent = t_old.postl_to_parent_[x]; parent >= 0 && old_state_[parent] == unclaimed; parent = t_old.postl_to_parent_[parent]) {
+                old_state_[parent] = above_claimed;
+                drop(parent);
+            }
+
+            prel += size;
+        }
+    }
+}
\ No newline at end of file
@@ -22,6 +22,12 @@
 
 #pragma once
 #include "touzet-dynamic.fwd.hpp"
+#include "band-scheduler.hpp"
+#include "edit-mapping.hpp"
+#include "instrumentation.hpp"
+#include "lazy-band.hpp"
+#include "retained-band.hpp"
+#include "subtree-hash.hpp"
 
 #include "matrix.h"
 #include "ted_algorithm_touzet.h"
@@ -29,18 +35,140 @@
 #include "touzet_depth_pruning_truncated_tree_fix_tree_index.h"
 
 #include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <string>
 #include <chrono>
+#include <vector>
+#include <unordered_map>
+#include <limits>
+#include <future>
+#include <memory>
+#include <utility>
+#include <type_traits>
 
 namespace ted {
 
     template <typename CostModel, typename TreeIndex>
     class DynamicTozuetTreeIndex : public TouzetDepthPruningTruncatedTreeFixTreeIndex<CostModel, TreeIndex> {
 
-        data_structures::BandMatrix<double> td_old_;
-        std::unordered_map<int, int> t1_preserved_subtrees;
-        std::unordered_map<int, int> t2_preserved_subtrees;
+    public:
+
+        static constexpr int not_preserved = -1;
+
+        // what one revision of a tree contributes to every pair it takes part in, so a tree shared by
+        // several pairs only has to be preprocessed once
+        struct Revision {
+            double d = 0; // distance from the previous revision
+            std::vector<int> preserved_subtrees; // new postl -> old postl, or not_preserved
+            long long int problems = 0;
+            double millis = 0;
+            [[no_unique_address]] Instrumentation<instrumented> instrumentation; // of preprocessing
+        };
+
+        using Retained = AdaptiveRetainedBand<typename RetainedValue<CostModel>::type, typename RetainedValue<CostModel>::wide>;
+
+        using Mapping = EditMapping<CostModel, TreeIndex>;
+
+        // everything retained between revisions of a single pair
+        struct PairState {
+            Retained td_old_;
+            double d_old_ = 0;
+            int k_old_ = 0;
+            Mapping mapping_;
+        };
+
+    private:
+
+        Retained td_old_; // within k_old_ of the diagonal, unless pruned
+
+        Mapping mapping_, next_mapping_; // of the last pair computed, and scratch for the next
+
+        Revision t1_revision_, t2_revision_; // storage for the pairwise overloads
+        const std::vector<int>* t1_preserved_subtrees; // of the revision in use
+        const std::vector<int>* t2_preserved_subtrees; // of the revision in use
+
+        // maximal stretch of consecutive t2 postl ids that map onto consecutive old postl ids
+        struct PreservedRun {
+            int new_begin;
+            int old_begin;
+            int length;
+        };
+
+        std::vector<PreservedRun> t2_preserved_runs; // ascending by new_begin
+
+        std::vector<int> label_histogram_;
+
+        // The cells of a td_ that passes may have written since it was last reset: those of their rows x
+        // columns problem within k of the diagonal.
+        struct WrittenBand {
+            int rows = 0;
+            int columns = 0;
+            int k = 0;
+
+            // Whether td is large enough for a rows x columns pass within k, in which case the cells written
+            // since the last reset are reset. Either way, that pass is what's written from then on.
+            bool reuse(data_structures::BandMatrix<double>& td, const int rows, const int columns, const int k);
+        };
+
+        WrittenBand td_written_;
+
+        // init_matrices for a t1_size x t2_size pass within k, except that td_ and fd_ are kept whenever
+        // they're at least that large and only the cells of td_ written since are reset, so steady-state
+        // revisions reuse them
+        void prepare_matrices(const int t1_size, const int t2_size, const int k);
+
+        std::unique_ptr<BandScheduler<CostModel, TreeIndex>> scheduler_; // while threads > 1
+
+        // the scheduler for this run, or nullptr to compute cells in place
+        BandScheduler<CostModel, TreeIndex>* scheduler();
+
+        ForestDistance<CostModel, TreeIndex> forest_distance_;
+
+        LazyBand<CostModel, TreeIndex> lazy_band_;
+
+        // td(x, y) computed in place by ForestDistance, the same kernel BandScheduler's workers run, so that
+        // the band doesn't depend on the number of threads
+        double tree_dist_in_place(const TreeIndex& t1, const TreeIndex& t2, const int x, const int y, const int e);
+
+        // answers a threshold query without a band if t1 and t2 are certainly further apart, in which case
+        // nothing is retained for them; returns whether it did
+        bool skip_beyond_threshold(const TreeIndex& t1, const TreeIndex& t2);
+
+        // computes t_old -> t_new on its own td_ / fd_, so the two trees can be preprocessed at once
+        class Preprocessor : public TouzetDepthPruningTruncatedTreeFixTreeIndex<CostModel, TreeIndex> {
+
+            using TEDAlgorithmTouzet<CostModel, TreeIndex>::td_;
+            using TEDAlgorithmTouzet<CostModel, TreeIndex>::subproblem_counter_;
+
+            void extract_preserved_subtrees(
+                const TreeIndex& t_old, const TreeIndex& t_new,
+                const std::unordered_map<size_t, size_t>& preserved_nodes,
+                std::vector<int>& preserved_subtrees
+            );
+
+            SubtreeMatcher<TreeIndex> matcher_;
+
+            WrittenBand td_written_;
+
+            // The inherited ted / ted_k, but on td_ / fd_ kept from one revision to the next, as prepare_matrices.
+            // Where matched (t2 postl -> t1 postl, or not_preserved) pairs up identical subtrees, their pairs of
+            // corresponding nodes are known to be 0 apart, and aren't computed.
+            double ted(const TreeIndex& t1, const TreeIndex& t2, const std::vector<int>* matched);
+            double ted_k(const TreeIndex& t1, const TreeIndex& t2, const int k, const std::vector<int>* matched);
+
+        public:
+
+            using TouzetDepthPruningTruncatedTreeFixTreeIndex<CostModel, TreeIndex>::TouzetDepthPruningTruncatedTreeFixTreeIndex;
+
+            void preprocess(
+                const TreeIndex& t_old, const TreeIndex& t_new,
+                const std::unordered_map<size_t, size_t>& preserved_nodes,
+                Revision& revision, const bool hash_subtrees
+            );
+        };
+
+        Preprocessor t1_preprocessor_, t2_preprocessor_;
 
     public:
 
@@ -50,7 +178,6 @@ namespace ted {
         using TEDAlgorithmTouzet<CostModel, TreeIndex>::subproblem_counter_;
         using TEDAlgorithmTouzet<CostModel, TreeIndex>::e_budget;
         using TEDAlgorithmTouzet<CostModel, TreeIndex>::k_relevant;
-        using TouzetDepthPruningTruncatedTreeFixTreeIndex<CostModel, TreeIndex>::TouzetDepthPruningTruncatedTreeFixTreeIndex;
         using TEDAlgorithmTouzet<CostModel, TreeIndex>::tree_dist;
 
         using TouzetDepthPruningTruncatedTreeFixTreeIndex<CostModel, TreeIndex>::ted_k;
@@ -59,18 +186,79 @@ namespace ted {
         double t2_d_;
         double d_old_;
         int k_old_;
+        int k_initial_;
         long long int subproblem_counter_precomp_;
 
-        std::chrono::milliseconds::rep t1_prep_millis;
-        std::chrono::milliseconds::rep t2_prep_millis;
-        std::chrono::milliseconds::rep ted_millis;
+        // fractional milliseconds
+        double t1_prep_millis;
+        double t2_prep_millis;
+        double ted_millis;
         long long int t1_prep_problems;
         long long int t2_prep_problems;
+        // Of the last pass, the k-relevant subtree pairs read from td_old_ and those recomputed. A pair is a
+        // hit wherever td_old_ still holds it, which after an unchanged step can be beyond k_old_ of the
+        // diagonal, so hits count the pairs actually reused rather than those within the old band; under
+        // lazy, only the pairs touched are counted at all.
         long long int hit;
         long long int missed;
 
+        // the last revision's measurements, including its preprocessing, when built with TED_INSTRUMENT
+        [[no_unique_address]] Instrumentation<instrumented> instrumentation;
+
+        // start the dynamic band from a cheap distance estimate and widen it on demand,
+        // rather than always using the t1_d_ + t2_d_ + d_old_ bound
+        bool adaptive_bound = false;
+
+        // before each dynamic pass, drop the parts of td_old_ that no preserved subtree pair can reach
+        bool prune_retained = false;
+
+        // when the baseline's bound grows, keep every cell of the narrower pass that's already exact rather
+        // than start the wider pass over
+        bool extend_band = false;
+
+        // When finite, every ted only answers whether the distance is within threshold: it returns the distance
+        // if so and infinity otherwise, with the band never wider than threshold. Pairs further apart than
+        // threshold by size or distance_lower_bound are answered without computing a band at all.
+        double threshold = std::numeric_limits<double>::infinity();
+
+        // evaluate each band top-down, touching only the pairs the roots' distance reads (see LazyBand), with
+        // hit + missed counting the pairs touched. Always on a single thread, and ignored under edit_mapping,
+        // whose backtrace reads pairs inside reused ones that a lazy pass never fills in, and for trees nested
+        // deeper than LazyBand::fits allows
+        bool lazy = false;
+
+        // backtrace an edit mapping after every ted that computes a band (see mapping())
+        bool edit_mapping = false;
+
+        // find preserved subtrees by fingerprint (see SubtreeMatcher) rather than from preserved_nodes, so
+        // revisions without node indices are reused too, and skip preprocessing identical revisions
+        bool hash_subtrees = false;
+
+        DynamicTozuetTreeIndex(const CostModel& c);
+
+        // compute band cells on this many threads; every pass computes them with ForestDistance, on one
+        // thread or many, so the band is the same whatever the count
+        int threads = 1;
+
         double ted(const TreeIndex& t1, const TreeIndex& t2);
 
+        // computes t_old -> t_new and the subtrees it preserves, leaving the retained state alone
+        void preprocess(
+            const TreeIndex& t_old, const TreeIndex& t_new,
+            const std::unordered_map<size_t, size_t>& preserved_nodes,
+            Revision& revision
+        );
+
+        // t1 and t2 are the current trees, each with the revision that produced it or nullptr if unchanged
+        double ted(const TreeIndex& t1, const Revision* t1_revision, const TreeIndex& t2, const Revision* t2_revision);
+
+        // swaps the retained state with that of another pair
+        void exchange(PairState& state);
+
+        // the edit mapping of the last pair computed, when edit_mapping is set; empty if it was beyond the
+        // threshold
+        const Mapping& mapping() const;
+
         double ted(
             const TreeIndex& t1_old, const TreeIndex& t1_new,
             const std::unordered_map<size_t, size_t>& t1_preserved_nodes,
@@ -90,8 +278,25 @@ namespace ted {
             const std::unordered_map<size_t, size_t>& t2_preserved_nodes
         );
 
+        template<bool t1_same, bool t2_same>
+        double bounded_dynamic_ted(const TreeIndex& t1, const TreeIndex& t2);
+
+        int distance_lower_bound(const TreeIndex& t1, const TreeIndex& t2);
+
+        // the inherited ted_k, but computing cells with ForestDistance, across the scheduler if there is one
+        double band_ted_k(const TreeIndex& t1, const TreeIndex& t2, const int k);
+
+        // ted_k, given that td_ holds the pass for k_from < k; only cells that pass didn't compute exactly are
+        // computed again
+        double extended_ted_k(const TreeIndex& t1, const TreeIndex& t2, const int k_from, const int k);
+
         template<bool t1_same, bool t2_same>
         double dynamic_ted_k(const TreeIndex& t1, const TreeIndex& t2, const int k);
+
+        // dynamic_ted_k (or, without reuse, ted_k) evaluated by LazyBand, so only the pairs the roots' distance
+        // reads are touched
+        template<bool t1_same, bool t2_same>
+        double lazy_ted_k(const TreeIndex& t1, const TreeIndex& t2, const int k, const bool reuse);
     };
 }
 
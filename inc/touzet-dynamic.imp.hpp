@@ -25,30 +25,66 @@
 
 namespace ted {
 
+    template <typename CostModel, typename TreeIndex>
+    DynamicTozuetTreeIndex<CostModel, TreeIndex>::DynamicTozuetTreeIndex(const CostModel& c) :
+        TouzetDepthPruningTruncatedTreeFixTreeIndex<CostModel, TreeIndex>(c), t1_preprocessor_(c), t2_preprocessor_(c) {}
+
     template <typename CostModel, typename TreeIndex>
     double DynamicTozuetTreeIndex<CostModel, TreeIndex>::ted(const TreeIndex& t1, const TreeIndex& t2) {
 
         t1_d_ = t2_d_ = 0;
-
-        int k = std::abs(t1.tree_size_ - t2.tree_size_) + 1;
+        d_old_ = std::numeric_limits<double>::infinity(); // nothing is known about this pair yet
 
         auto start = std::chrono::high_resolution_clock::now();
-        double distance = ted_k(t1, t2, k);
+
+        if (skip_beyond_threshold(t1, t2)) {
+            auto stop = std::chrono::high_resolution_clock::now();
+            ted_millis = std::chrono::duration<double, std::milli>(stop - start).count();
+            mapping_.clear();
+            return d_old_;
+        }
+
+        const int k_max = std::isinf(threshold) ? std::numeric_limits<int>::max() : static_cast<int>(threshold);
+
+        int k = std::min(std::abs(t1.tree_size_ - t2.tree_size_) + 1, k_max);
+        k_initial_ = k;
+
+        const bool lazy_pass = lazy && !edit_mapping && lazy_band_.fits(t1, t2);
+
+        auto bounded_ted = [&] {
+            if (lazy_pass) return lazy_ted_k<true, true>(t1, t2, k, false);
+            return band_ted_k(t1, t2, k);
+        };
+
+        start = std::chrono::high_resolution_clock::now();
+        double distance = bounded_ted();
         auto stop = std::chrono::high_resolution_clock::now();
 
-        while (k < distance) {
-            k <<= 2;
+        while (k < distance && k < k_max) {
+            const int k_from = k;
+            k = std::min(k << 2, k_max);
             start = std::chrono::high_resolution_clock::now();
-            distance = ted_k(t1, t2, k);
+            distance = extend_band && !lazy_pass ? extended_ted_k(t1, t2, k_from, k) : bounded_ted();
             stop = std::chrono::high_resolution_clock::now();
         }
 
         // we only vaguely care about the last iteration for problem set-up, this value isn't recorded anyway...
-        ted_millis = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+        ted_millis = std::chrono::duration<double, std::milli>(stop - start).count();
+
+        // only a threshold stops the search short of the distance
+        if (distance > k) distance = std::numeric_limits<double>::infinity();
 
-        k_old_ = distance;
+        k_old_ = std::isinf(distance) ? k : distance;
         d_old_ = distance;
-        td_old_ = std::move(td_);
+        td_old_.assign(td_, t1.tree_size_, t2.tree_size_, k_old_);
+
+        td_written_ = { t1.tree_size_, t2.tree_size_, k };
+
+        if (edit_mapping) {
+            mapping_.clear(); // a new pair has nothing to reuse
+            next_mapping_.backtrace(this->c_, t1, t2, td_, distance, nullptr, nullptr, mapping_);
+            std::swap(mapping_, next_mapping_);
+        }
 
         return distance;
     };
@@ -60,178 +96,452 @@ namespace ted {
         const TreeIndex& t2_old, const TreeIndex& t2_new,
         const std::unordered_map<size_t, size_t>& t2_preserved_nodes
     ) {
+        // the two sides are independent, so t2 is preprocessed on a worker of its own meanwhile
+        auto t2_preprocessed = std::async(std::launch::async, [&] {
+            t2_preprocessor_.preprocess(t2_old, t2_new, t2_preserved_nodes, t2_revision_, hash_subtrees); // get distances for t2
+        });
+        t1_preprocessor_.preprocess(t1_old, t1_new, t1_preserved_nodes, t1_revision_, hash_subtrees); // get distances for t1
+        t2_preprocessed.get();
+
+        return ted(t1_new, &t1_revision_, t2_new, &t2_revision_);
+    };
 
-        t1_preserved_subtrees.clear();
-        t2_preserved_subtrees.clear();
-
-        hit = 0;
-        missed = 0;
+    template <typename CostModel, typename TreeIndex>
+    double DynamicTozuetTreeIndex<CostModel, TreeIndex>::ted(
+        const TreeIndex& t1_old, const TreeIndex& t1_new,
+        const std::unordered_map<size_t, size_t>& t1_preserved_nodes,
+        const TreeIndex& t2_old
+    ) {
+        t1_preprocessor_.preprocess(t1_old, t1_new, t1_preserved_nodes, t1_revision_, hash_subtrees); // get distances for t1
+        return ted(t1_new, &t1_revision_, t2_old, nullptr);
+    };
 
-        auto start = std::chrono::high_resolution_clock::now();
+    template <typename CostModel, typename TreeIndex>
+    double DynamicTozuetTreeIndex<CostModel, TreeIndex>::ted(
+        const TreeIndex& t1_old,
+        const TreeIndex& t2_old, const TreeIndex& t2_new,
+        const std::unordered_map<size_t, size_t>& t2_preserved_nodes  // new_prel -> old_prel
+    ) {
+        t2_preprocessor_.preprocess(t2_old, t2_new, t2_preserved_nodes, t2_revision_, hash_subtrees); // get distances for t2
+        return ted(t1_old, nullptr, t2_new, &t2_revision_);
+    };
 
-        t1_d_ = TouzetDepthPruningTruncatedTreeFixTreeIndex<CostModel, TreeIndex>::ted(t1_old, t1_new); // get distances for t1
-        if (t1_d_) for (auto [new_prel, old_prel] : t1_preserved_nodes) {
-            auto new_postl = t1_new.prel_to_postl_[new_prel];
-            auto old_postl = t1_old.prel_to_postl_[old_prel];
-            if (td_.read_at(old_postl, new_postl) == 0) t1_preserved_subtrees[new_postl] = old_postl;
-        }
+    template <typename CostModel, typename TreeIndex>
+    void DynamicTozuetTreeIndex<CostModel, TreeIndex>::preprocess(
+        const TreeIndex& t_old, const TreeIndex& t_new,
+        const std::unordered_map<size_t, size_t>& preserved_nodes, // new_prel -> old_prel
+        Revision& revision
+    ) {
+        t1_preprocessor_.preprocess(t_old, t_new, preserved_nodes, revision, hash_subtrees);
+    }
 
-        auto stop = std::chrono::high_resolution_clock::now();
+    template <typename CostModel, typename TreeIndex>
+    void DynamicTozuetTreeIndex<CostModel, TreeIndex>::Preprocessor::preprocess(
+        const TreeIndex& t_old, const TreeIndex& t_new,
+        const std::unordered_map<size_t, size_t>& preserved_nodes, // new_prel -> old_prel
+        Revision& revision, const bool hash_subtrees
+    ) {
+        revision.instrumentation.reset();
 
-        t1_prep_problems = subproblem_counter_;
+        auto start = std::chrono::high_resolution_clock::now();
 
-        t1_prep_millis = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+        auto phase = revision.instrumentation.now();
+        const bool identical = hash_subtrees && matcher_.identical(t_old, t_new);
+        revision.instrumentation.add(Phase::extract_preserved, phase);
 
-        start = std::chrono::high_resolution_clock::now();
+        if (identical) {
+            revision.d = 0;
+            subproblem_counter_ = 0; // rather than whatever the last revision left behind
+        }
+        else {
+            // matched first, so that the TED needn't compute the subtrees it already knows are identical
+            if (hash_subtrees) {
+                phase = revision.instrumentation.now();
+                matcher_.match(t_old, t_new, revision.preserved_subtrees, not_preserved);
+                revision.instrumentation.add(Phase::extract_preserved, phase);
+            }
 
-        t2_d_ = TouzetDepthPruningTruncatedTreeFixTreeIndex<CostModel, TreeIndex>::ted(t2_old, t2_new); // get distances for t2
-        if (t2_d_) for (auto [new_prel, old_prel] : t2_preserved_nodes) {
-            auto new_postl = t2_new.prel_to_postl_[new_prel];
-            auto old_postl = t2_old.prel_to_postl_[old_prel];
-            if (td_.read_at(old_postl, new_postl) == 0) t2_preserved_subtrees[new_postl] = old_postl;
+            phase = revision.instrumentation.now();
+            revision.d = ted(t_old, t_new, hash_subtrees ? &revision.preserved_subtrees : nullptr);
+            revision.instrumentation.add(Phase::preprocess_ted, phase);
         }
 
-        stop = std::chrono::high_resolution_clock::now();
+        if (revision.d && !hash_subtrees) {
+            phase = revision.instrumentation.now();
+            extract_preserved_subtrees(t_old, t_new, preserved_nodes, revision.preserved_subtrees);
+            revision.instrumentation.add(Phase::extract_preserved, phase);
+        }
 
-        t2_prep_problems = subproblem_counter_;
+        auto stop = std::chrono::high_resolution_clock::now();
 
-        t2_prep_millis = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+        revision.problems = subproblem_counter_;
+        revision.millis = std::chrono::duration<double, std::milli>(stop - start).count();
+    }
 
-        int k = t1_d_ + t2_d_ + d_old_;
+    template <typename CostModel, typename TreeIndex>
+    double DynamicTozuetTreeIndex<CostModel, TreeIndex>::Preprocessor::ted(const TreeIndex& t1, const TreeIndex& t2, const std::vector<int>* matched) {
+        int k = std::abs(t1.tree_size_ - t2.tree_size_) + 1;
+        double distance = ted_k(t1, t2, k, matched);
+        while (k < distance) {
+            k <<= 1;
+            distance = ted_k(t1, t2, k, matched);
+        }
+        return distance;
+    }
 
-        start = std::chrono::high_resolution_clock::now();
+    template <typename CostModel, typename TreeIndex>
+    double DynamicTozuetTreeIndex<CostModel, TreeIndex>::Preprocessor::ted_k(const TreeIndex& t1, const TreeIndex& t2, const int k, const std::vector<int>* matched) {
 
-        double distance;
-        if (t1_d_ && t2_d_) distance = dynamic_ted_k<false, false>(t1_new, t2_new, k);
-        else if (t1_d_) distance = dynamic_ted_k<false, true>(t1_new, t2_new, k);
-        else if (t2_d_) distance = dynamic_ted_k<true, false>(t1_new, t2_new, k);
-        else distance = d_old_;
+        const int t1_size = t1.tree_size_;
+        const int t2_size = t2.tree_size_;
 
-        stop = std::chrono::high_resolution_clock::now();
+        if (!td_written_.reuse(td_, t1_size, t2_size, k)) this->init_matrices(t1_size + t1_size / 16, k + k / 8);
 
-        ted_millis = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+        subproblem_counter_ = 0;
 
-        k_old_ = k;
-        d_old_ = distance;
+        if (std::abs(t1_size - t2_size) > k) {
+            return std::numeric_limits<double>::infinity();
+        }
 
-        if (t1_d_ || t2_d_) td_old_ = std::move(td_);
+        for (int x = 0; x < t1_size; ++x) {
+            for (int y = std::max(0, x - k); y <= std::min(x + k, t2_size - 1); ++y) {
+                if (!this->k_relevant(t1, t2, x, y, k)) continue;
+                if (matched && (*matched)[y] == x) td_.at(x, y) = 0;
+                else td_.at(x, y) = this->tree_dist(t1, t2, x, y, k, this->e_budget(t1, t2, x, y, k));
+            }
+        }
 
-        return distance;
-    };
+        return td_.at(t1_size - 1, t2_size - 1);
+    }
 
     template <typename CostModel, typename TreeIndex>
     double DynamicTozuetTreeIndex<CostModel, TreeIndex>::ted(
-        const TreeIndex& t1_old, const TreeIndex& t1_new,
-        const std::unordered_map<size_t, size_t>& t1_preserved_nodes,
-        const TreeIndex& t2_old
+        const TreeIndex& t1, const Revision* t1_revision,
+        const TreeIndex& t2, const Revision* t2_revision
     ) {
 
-        t2_d_ = 0;
+        t1_d_ = t1_revision ? t1_revision->d : 0;
+        t2_d_ = t2_revision ? t2_revision->d : 0;
 
-        t1_preserved_subtrees.clear();
-        t2_preserved_subtrees.clear();
+        t1_prep_problems = t1_revision ? t1_revision->problems : 0;
+        t2_prep_problems = t2_revision ? t2_revision->problems : 0;
+        t1_prep_millis = t1_revision ? t1_revision->millis : 0;
+        t2_prep_millis = t2_revision ? t2_revision->millis : 0;
 
-        t2_prep_problems = 0;
-        t2_prep_millis = 0;
+        t1_preserved_subtrees = t1_d_ ? &t1_revision->preserved_subtrees : nullptr;
+        t2_preserved_subtrees = t2_d_ ? &t2_revision->preserved_subtrees : nullptr;
 
         hit = 0;
         missed = 0;
 
+        instrumentation.reset();
+        if (t1_revision) instrumentation.merge(t1_revision->instrumentation);
+        if (t2_revision) instrumentation.merge(t2_revision->instrumentation);
+
         auto start = std::chrono::high_resolution_clock::now();
 
-        t1_d_ = TouzetDepthPruningTruncatedTreeFixTreeIndex<CostModel, TreeIndex>::ted(t1_old, t1_new); // get distances for t2
-        if (t1_d_) for (auto [new_prel, old_prel] : t1_preserved_nodes) {
-            auto new_postl = t1_new.prel_to_postl_[new_prel];
-            auto old_postl = t1_old.prel_to_postl_[old_prel];
-            if (td_.read_at(old_postl, new_postl) == 0) t1_preserved_subtrees[new_postl] = old_postl;
+        if (prune_retained && (t1_d_ || t2_d_)) td_old_.retain(t1_preserved_subtrees, t2_preserved_subtrees);
+
+        const bool computed = t1_d_ || t2_d_ || std::isinf(d_old_);
+
+        double distance;
+        if (t1_d_ && t2_d_) distance = bounded_dynamic_ted<false, false>(t1, t2);
+        else if (t1_d_) distance = bounded_dynamic_ted<false, true>(t1, t2);
+        else if (t2_d_) distance = bounded_dynamic_ted<true, false>(t1, t2);
+        else if (std::isinf(d_old_)) distance = bounded_dynamic_ted<true, true>(t1, t2); // so far only known to be beyond a threshold
+        else {
+            k_initial_ = k_old_ = distance = d_old_;
+            subproblem_counter_ = 0; // rather than whatever preprocessing left behind
         }
 
         auto stop = std::chrono::high_resolution_clock::now();
 
-        t1_prep_problems = subproblem_counter_;
+        ted_millis = std::chrono::duration<double, std::milli>(stop - start).count();
 
-        t1_prep_millis = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+        d_old_ = distance;
 
-        int k = t1_d_ + t2_d_ + d_old_;
+        // fragments of the last mapping are reused where both subtrees are preserved
+        if (edit_mapping && computed) {
+            next_mapping_.backtrace(this->c_, t1, t2, td_, distance, t1_preserved_subtrees, t2_preserved_subtrees, mapping_);
+            std::swap(mapping_, next_mapping_);
+        }
 
-        start = std::chrono::high_resolution_clock::now();
+        return distance <= threshold ? distance : std::numeric_limits<double>::infinity();
+    };
 
-        double distance;
-        if (t1_d_)distance = dynamic_ted_k<false, true>(t1_new, t2_old, k);
-        else distance = d_old_;
+    template <typename CostModel, typename TreeIndex>
+    void DynamicTozuetTreeIndex<CostModel, TreeIndex>::exchange(PairState& state) {
+        std::swap(td_old_, state.td_old_);
+        std::swap(d_old_, state.d_old_);
+        std::swap(k_old_, state.k_old_);
+        std::swap(mapping_, state.mapping_);
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    const typename DynamicTozuetTreeIndex<CostModel, TreeIndex>::Mapping& DynamicTozuetTreeIndex<CostModel, TreeIndex>::mapping() const {
+        return mapping_;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    template <bool t1_same, bool t2_same>
+    double DynamicTozuetTreeIndex<CostModel, TreeIndex>::bounded_dynamic_ted(const TreeIndex& t1, const TreeIndex& t2) {
+
+        if (skip_beyond_threshold(t1, t2)) return std::numeric_limits<double>::infinity();
+
+        // the triangle inequality is always sufficient, and so is deleting t1 and inserting t2 when d_old_ is
+        // only known to be beyond a threshold
+        const double k_bound = std::isinf(d_old_) ? t1.tree_size_ + t2.tree_size_ : t1_d_ + t2_d_ + d_old_;
+        const int k_max = std::min(k_bound, threshold);
+
+        int k = k_max;
+        if (adaptive_bound) k = std::min(std::max({ 1, distance_lower_bound(t1, t2), std::isinf(d_old_) ? 0 : static_cast<int>(d_old_) }), k_max);
+
+        k_initial_ = k;
 
-        stop = std::chrono::high_resolution_clock::now();
+        const bool lazy_pass = lazy && !edit_mapping && lazy_band_.fits(t1, t2);
 
-        ted_millis = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+        auto pass = [&] { return lazy_pass ? lazy_ted_k<t1_same, t2_same>(t1, t2, k, true) : dynamic_ted_k<t1_same, t2_same>(t1, t2, k); };
+
+        // td_old_ is left untouched until the last pass is retained, so every pass reuses it
+        double distance = pass();
+        while (k < distance && k < k_max) {
+            k = std::min(k << 2, k_max);
+            distance = pass();
+        }
 
         k_old_ = k;
-        d_old_ = distance;
+        td_old_.assign(td_, t1.tree_size_, t2.tree_size_, k_old_);
 
-        if (t1_d_) td_old_ = std::move(td_);
+        // only a threshold stops the search short of the distance
+        return distance <= k ? distance : std::numeric_limits<double>::infinity();
+    }
 
-        return distance;
-    };
+    template <typename CostModel, typename TreeIndex>
+    int DynamicTozuetTreeIndex<CostModel, TreeIndex>::distance_lower_bound(const TreeIndex& t1, const TreeIndex& t2) {
+
+        // like the k bounds themselves, these assume unit costs
+        const int t1_size = t1.tree_size_;
+        const int t2_size = t2.tree_size_;
+
+        int bound = std::abs(t1_size - t2_size);
+        if (!std::isinf(d_old_)) bound = std::max(bound, static_cast<int>(d_old_ - t1_d_ - t2_d_));
+
+        // every node beyond the shared label multiset must be deleted, inserted or renamed
+        int max_label_id = 0;
+        for (int x = 0; x < t1_size; ++x) max_label_id = std::max(max_label_id, t1.postl_to_label_id_[x]);
+        for (int y = 0; y < t2_size; ++y) max_label_id = std::max(max_label_id, t2.postl_to_label_id_[y]);
+
+        label_histogram_.assign(max_label_id + 1, 0);
+        for (int x = 0; x < t1_size; ++x) label_histogram_[t1.postl_to_label_id_[x]]++;
+
+        int common = 0;
+        for (int y = 0; y < t2_size; ++y) {
+            auto& count = label_histogram_[t2.postl_to_label_id_[y]];
+            if (count) {
+                count--;
+                common++;
+            }
+        }
+
+        return std::max(bound, std::max(t1_size, t2_size) - common);
+    }
 
     template <typename CostModel, typename TreeIndex>
-    double DynamicTozuetTreeIndex<CostModel, TreeIndex>::ted(
-        const TreeIndex& t1_old,
-        const TreeIndex& t2_old, const TreeIndex& t2_new,
-        const std::unordered_map<size_t, size_t>& t2_preserved_nodes  // new_prel -> old_prel
-    ) {
+    template <bool t1_same, bool t2_same>
+    double DynamicTozuetTreeIndex<CostModel, TreeIndex>::dynamic_ted_k(const TreeIndex& t1, const TreeIndex& t2, const int k) {
 
-        t1_d_ = 0;
+        const int t1_size = t1.tree_size_;
+        const int t2_size = t2.tree_size_;
 
-        t1_preserved_subtrees.clear();
-        t2_preserved_subtrees.clear();
+        auto phase = instrumentation.now();
+        prepare_matrices(t1_size, t2_size, k);
+        instrumentation.add(Phase::init_matrices, phase);
 
-        t1_prep_problems = 0;
-        t1_prep_millis = 0;
+        subproblem_counter_ = 0;
 
-        hit = 0;
-        missed = 0;
+        if (std::abs(t1_size - t2_size) > k) {
+            return std::numeric_limits<double>::infinity();
+        }
 
-        auto start = std::chrono::high_resolution_clock::now();
+        const auto scan = instrumentation.now();
+        const auto scan_tree_dist = instrumentation.total(Phase::tree_dist);
 
-        t2_d_ = TouzetDepthPruningTruncatedTreeFixTreeIndex<CostModel, TreeIndex>::ted(t2_old, t2_new); // get distances for t2
-        if (t2_d_) for (auto [new_prel, old_prel] : t2_preserved_nodes) {
-            auto new_postl = t2_new.prel_to_postl_[new_prel];
-            auto old_postl = t2_old.prel_to_postl_[old_prel];
-            if (td_.read_at(old_postl, new_postl) == 0) t2_preserved_subtrees[new_postl] = old_postl;
+        t2_preserved_runs.clear();
+        if constexpr (t2_same) {
+            t2_preserved_runs.push_back({ 0, 0, t2_size });
+        }
+        else for (int y = 0; y < t2_size; ++y) {
+            const int old_y = (*t2_preserved_subtrees)[y];
+            if (old_y == not_preserved) continue;
+            if (!t2_preserved_runs.empty()) {
+                auto& run = t2_preserved_runs.back();
+                if (run.new_begin + run.length == y && run.old_begin + run.length == old_y) {
+                    run.length++;
+                    continue;
+                }
+            }
+            t2_preserved_runs.push_back({ y, old_y, 1 });
         }
 
-        auto stop = std::chrono::high_resolution_clock::now();
+        auto* const parallel = scheduler();
+
+        auto recompute = [&](const int x, const int y_from, const int y_to) {
+            for (int y = y_from; y <= y_to; ++y) {
+                if (k_relevant(t1, t2, x, y, k)) {
+                    const int budget = e_budget(t1, t2, x, y, k);
+                    instrumentation.recomputed(t1.postl_to_size_[x] + t2.postl_to_size_[y], budget);
+                    if (parallel) parallel->push(x, y, budget);
+                    else {
+                        const auto cell = instrumentation.now();
+                        td_.at(x, y) = tree_dist_in_place(t1, t2, x, y, budget);
+                        instrumentation.add(Phase::tree_dist, cell);
+                    }
+                    missed++;
+                } // otherwise it wasn't computed orginally and still isn't needed now
+            }
+        };
 
-        t2_prep_problems = subproblem_counter_;
+        // td_old_ is held in whichever width fits the last problem
+        td_old_.visit([&](const auto& td_old) {
 
-        t2_prep_millis = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+            using Band = std::remove_cvref_t<decltype(td_old)>;
 
-        int k = t1_d_ + t2_d_ + d_old_;
+            // runs are visited in ascending order, and the band only ever slides right
+            auto first_run = t2_preserved_runs.cbegin();
 
-        start = std::chrono::high_resolution_clock::now();
+            for (int x = 0; x < t1_size; ++x) {
 
-        double distance;
-        if (t2_d_) distance = dynamic_ted_k<true, false>(t1_old, t2_new, k);
-        else distance = d_old_;
+                const int y_begin = std::max(0, x - k);
+                const int y_end = std::min(x + k, t2_size - 1);
+                const int old_x = t1_same ? x : (*t1_preserved_subtrees)[x];
+                const long long int row_filled = hit + missed;
 
-        stop = std::chrono::high_resolution_clock::now();
+                int y = y_begin;
 
-        ted_millis = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+                if (old_x != not_preserved) {
 
-        k_old_ = k;
-        d_old_ = distance;
+                    while (first_run != t2_preserved_runs.cend() && first_run->new_begin + first_run->length <= y_begin) ++first_run;
 
-        if (t2_d_) td_old_ = std::move(td_);
+                    for (auto run = first_run; run != t2_preserved_runs.cend() && run->new_begin <= y_end; ++run) {
 
-        return distance;
-    };
+                        // clip the run to both the new band and the part of the old band that's held
+                        const int offset = run->old_begin - run->new_begin;
+                        const int block_begin = std::max({ y, run->new_begin, td_old.first(old_x) - offset });
+                        const int block_end = std::min({ y_end, run->new_begin + run->length - 1, td_old.last(old_x) - offset });
+
+                        if (block_begin > block_end) continue;
+
+                        recompute(x, y, block_begin - 1);
+
+                        // band rows are stored contiguously, so a block is a single strip on both sides
+                        double* block = &td_.at(x, block_begin);
+                        const auto* retained = td_old.at(old_x, block_begin + offset);
+
+                        for (y = block_begin; y <= block_end; ++y, ++block, ++retained) {
+                            if (*retained != Band::not_computed) {
+                                *block = *retained;
+                                hit++;
+                            }
+                            else recompute(x, y, y); // never computed before, but may be needed now
+                        }
+                    }
+                }
+
+                recompute(x, y, y_end);
+
+                instrumentation.band(y_end - y_begin + 1, hit + missed - row_filled);
+            }
+        });
+
+        instrumentation.add(Phase::reuse_scan, scan, instrumentation.total(Phase::tree_dist) - scan_tree_dist);
+
+        // every reused cell is already in place, the rest only depend on each other and on those
+        if (parallel) {
+            const auto cells = instrumentation.now();
+            subproblem_counter_ += parallel->run(t1, t2, td_);
+            instrumentation.add(Phase::tree_dist, cells);
+        }
+
+        return td_.at(t1.tree_size_ - 1, t2.tree_size_ - 1);
+    }
 
     template <typename CostModel, typename TreeIndex>
     template <bool t1_same, bool t2_same>
-    double DynamicTozuetTreeIndex<CostModel, TreeIndex>::dynamic_ted_k(const TreeIndex& t1, const TreeIndex& t2, const int k) {
+    double DynamicTozuetTreeIndex<CostModel, TreeIndex>::lazy_ted_k(const TreeIndex& t1, const TreeIndex& t2, const int k, const bool reuse) {
+
+        auto phase = instrumentation.now();
+        prepare_matrices(t1.tree_size_, t2.tree_size_, k);
+        instrumentation.add(Phase::init_matrices, phase);
+
+        subproblem_counter_ = 0;
+
+        // a pair is reused where both its subtrees are preserved and the last revision computed it
+        auto retained = [&](const int x, const int y) {
+            if (reuse) {
+                const int old_x = t1_same ? x : (*t1_preserved_subtrees)[x];
+                const int old_y = t2_same ? y : (*t2_preserved_subtrees)[y];
+                if (old_x != not_preserved && old_y != not_preserved) {
+                    return td_old_.visit([&](const auto& td_old) {
+                        using Band = std::remove_cvref_t<decltype(td_old)>;
+                        if (td_old.first(old_x) <= old_y && old_y <= td_old.last(old_x)) {
+                            const auto distance = *td_old.at(old_x, old_y);
+                            if (distance != Band::not_computed) return static_cast<double>(distance);
+                        }
+                        return std::numeric_limits<double>::quiet_NaN();
+                    });
+                }
+            }
+            return std::numeric_limits<double>::quiet_NaN();
+        };
+
+        auto budget = [&](const int x, const int y) { return k_relevant(t1, t2, x, y, k) ? e_budget(t1, t2, x, y, k) : -1; };
+
+        phase = instrumentation.now();
+        const double distance = lazy_band_.evaluate(this->c_, t1, t2, td_, k, retained, budget, subproblem_counter_);
+        instrumentation.add(Phase::tree_dist, phase);
+
+        hit += lazy_band_.hit;
+        missed += lazy_band_.missed;
+
+        return distance;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    double DynamicTozuetTreeIndex<CostModel, TreeIndex>::band_ted_k(const TreeIndex& t1, const TreeIndex& t2, const int k) {
 
         const int t1_size = t1.tree_size_;
         const int t2_size = t2.tree_size_;
 
+        prepare_matrices(t1_size, t2_size, k);
+
+        subproblem_counter_ = 0;
+
+        if (std::abs(t1_size - t2_size) > k) {
+            return std::numeric_limits<double>::infinity();
+        }
+
+        auto* const parallel = scheduler();
+
+        for (int x = 0; x < t1_size; ++x) {
+            for (int y = std::max(0, x - k); y <= std::min(x + k, t2_size - 1); ++y) {
+                if (!k_relevant(t1, t2, x, y, k)) continue;
+                if (parallel) parallel->push(x, y, e_budget(t1, t2, x, y, k));
+                else td_.at(x, y) = tree_dist_in_place(t1, t2, x, y, e_budget(t1, t2, x, y, k));
+            }
+        }
+
+        if (parallel) subproblem_counter_ += parallel->run(t1, t2, td_);
+
+        return td_.at(t1_size - 1, t2_size - 1);
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    double DynamicTozuetTreeIndex<CostModel, TreeIndex>::extended_ted_k(const TreeIndex& t1, const TreeIndex& t2, const int k_from, const int k) {
+
+        const int t1_size = t1.tree_size_;
+        const int t2_size = t2.tree_size_;
+
+        auto previous = std::move(td_);
         init_matrices(t1_size, k);
 
         subproblem_counter_ = 0;
@@ -240,39 +550,107 @@ namespace ted {
             return std::numeric_limits<double>::infinity();
         }
 
+        auto* const parallel = scheduler();
+
         for (int x = 0; x < t1_size; ++x) {
             for (int y = std::max(0, x - k); y <= std::min(x + k, t2_size - 1); ++y) {
 
-                double distance = std::numeric_limits<double>::infinity();
+                if (!k_relevant(t1, t2, x, y, k)) continue;
 
-                if constexpr (!t1_same && !t2_same) {
-                    if (t1_preserved_subtrees.contains(x) && t2_preserved_subtrees.contains(y) && std::abs(t1_preserved_subtrees[x] - t2_preserved_subtrees[y]) <= k_old_) {
-                        distance = td_old_.read_at(t1_preserved_subtrees[x], t2_preserved_subtrees[y]);
-                    }
-                }
-                else if constexpr (t1_same) {
-                    if (t2_preserved_subtrees.contains(y) && std::abs(x - t2_preserved_subtrees[y]) <= k_old_) {
-                        distance = td_old_.read_at(x, t2_preserved_subtrees[y]);
-                    }
-                }
-                else if constexpr (t2_same) {
-                    if (t1_preserved_subtrees.contains(x) && std::abs(t1_preserved_subtrees[x] - y) <= k_old_) {
-                        distance = td_old_.read_at(t1_preserved_subtrees[x], y);
+                // a distance within the budget it was computed with is exact, and so the same with any larger one
+                if (std::abs(x - y) <= k_from && k_relevant(t1, t2, x, y, k_from)) {
+                    const double distance = previous.read_at(x, y);
+                    if (distance <= e_budget(t1, t2, x, y, k_from)) {
+                        td_.at(x, y) = distance;
+                        continue;
                     }
                 }
 
-                if (!std::isinf(distance)) {
-                    td_.at(x, y) = distance;
-                    hit++;
-                }
-                else if (k_relevant(t1, t2, x, y, k)) {
-                    td_.at(x, y) = tree_dist(t1, t2, x, y, k, e_budget(t1, t2, x, y, k));
-                    missed++;
-                } // otherwise it wasn't computed orginally and still isn't needed now
+                if (parallel) parallel->push(x, y, e_budget(t1, t2, x, y, k));
+                else td_.at(x, y) = tree_dist_in_place(t1, t2, x, y, e_budget(t1, t2, x, y, k));
+            }
+        }
+
+        if (parallel) subproblem_counter_ += parallel->run(t1, t2, td_);
+
+        return td_.at(t1_size - 1, t2_size - 1);
+    }
 
+    template <typename CostModel, typename TreeIndex>
+    bool DynamicTozuetTreeIndex<CostModel, TreeIndex>::WrittenBand::reuse(
+        data_structures::BandMatrix<double>& td, const int rows, const int columns, const int k
+    ) {
+        const bool fits = td.get_rows() >= rows && td.get_band_width() >= k;
+
+        // a pass only writes cells of its own problem, and rows are contiguous
+        if (fits) {
+            for (int x = 0; x < this->rows; ++x) {
+                const int first = std::max(0, x - this->k);
+                const int last = std::min(x + this->k, this->columns - 1);
+                if (first <= last) std::fill_n(&td.at(x, first), last - first + 1, std::numeric_limits<double>::infinity());
             }
         }
 
-        return td_.at(t1.tree_size_ - 1, t2.tree_size_ - 1);
+        this->rows = rows;
+        this->columns = columns;
+        this->k = k;
+
+        return fits;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    void DynamicTozuetTreeIndex<CostModel, TreeIndex>::prepare_matrices(const int t1_size, const int t2_size, const int k) {
+
+        // cells outside a pass's band are never written, and read as infinite; tree_dist re-initialises
+        // every fd_ cell it reads, so only td_ needs resetting
+        if (!td_written_.reuse(td_, t1_size, t2_size, k)) {
+            // a little headroom, so that trees and bands growing slowly don't reallocate every revision
+            init_matrices(t1_size + t1_size / 16, k + k / 8);
+        }
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    BandScheduler<CostModel, TreeIndex>* DynamicTozuetTreeIndex<CostModel, TreeIndex>::scheduler() {
+        if (threads <= 1) {
+            scheduler_.reset();
+            return nullptr;
+        }
+        if (!scheduler_ || scheduler_->threads() != threads) scheduler_ = std::make_unique<BandScheduler<CostModel, TreeIndex>>(this->c_, threads);
+        return scheduler_.get();
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    double DynamicTozuetTreeIndex<CostModel, TreeIndex>::tree_dist_in_place(
+        const TreeIndex& t1, const TreeIndex& t2, const int x, const int y, const int e
+    ) {
+        return forest_distance_(this->c_, t1, t2, td_, x, y, e, subproblem_counter_);
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    bool DynamicTozuetTreeIndex<CostModel, TreeIndex>::skip_beyond_threshold(const TreeIndex& t1, const TreeIndex& t2) {
+
+        if (std::isinf(threshold)) return false;
+        if (std::abs(t1.tree_size_ - t2.tree_size_) <= threshold && distance_lower_bound(t1, t2) <= threshold) return false;
+
+        k_initial_ = k_old_ = 0;
+        subproblem_counter_ = 0;
+        td_old_.clear(t1.tree_size_);
+
+        return true;
+    }
+
+    template <typename CostModel, typename TreeIndex>
+    void DynamicTozuetTreeIndex<CostModel, TreeIndex>::Preprocessor::extract_preserved_subtrees(
+        const TreeIndex& t_old, const TreeIndex& t_new,
+        const std::unordered_map<size_t, size_t>& preserved_nodes, // new_prel -> old_prel
+        std::vector<int>& preserved_subtrees
+    ) {
+        // relies on td_ still holding the t_old -> t_new distances
+        preserved_subtrees.assign(t_new.tree_size_, not_preserved);
+        for (auto [new_prel, old_prel] : preserved_nodes) {
+            auto new_postl = t_new.prel_to_postl_[new_prel];
+            auto old_postl = t_old.prel_to_postl_[old_prel];
+            if (td_.read_at(old_postl, new_postl) == 0) preserved_subtrees[new_postl] = old_postl;
+        }
     }
 }
\ No newline at end of file
@@ -0,0 +1,164 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "tree-update.fwd.hpp"
+
+#include "node.h"
+#include "tree_indexer.h"
+#include "label_dictionary.h"
+
+#include <cstddef>
+#include <vector>
+#include <variant>
+#include <optional>
+#include <functional>
+#include <unordered_map>
+
+namespace update {
+
+    // Builders consume a preorder stream of open / close events:
+    //   reserve(capacity) before the first open, with capacity at least the number of nodes opened
+    //   open(label_id) returning the new node's prel, close(), and finish() once the stream ends
+
+    // Fills the components of a TreeIndex from the event stream, without an intermediate node::Node tree. Only the components below are written; anything else the index
+    // carries (KR sets, right-to-left orders, ...) is left alone and still needs node::index_tree.
+    //   tree_size_, prel_to_label_id_, postl_to_label_id_, prel_to_size_, postl_to_size_,
+    //   prel_to_parent_, postl_to_parent_, postl_to_lld_, postl_to_depth_, prel_to_postl_,
+    //   postl_to_prel_, postl_to_subtree_max_depth_
+    template <typename TreeIndex>
+    class IndexBuilder {
+
+        TreeIndex& index_;
+
+        struct OpenNode {
+            int prel;
+            int label_id;
+            int max_depth; // deepest node seen so far in the subtree
+        };
+
+        std::vector<OpenNode> stack_; // root first
+        std::vector<int> prel_to_postl_;
+        std::vector<int> prel_to_parent_;
+
+        int next_prel_;
+        int next_postl_;
+
+    public:
+
+        IndexBuilder(TreeIndex& index);
+
+        void reserve(int capacity);
+        int open(int label_id);
+        void close();
+        void finish();
+    };
+
+    // Exactly the components IndexBuilder fills, which is everything the dynamic engine and the Touzet
+    // depth-pruning engines read. Revisions are indexed straight from the parser or an edit script, with
+    // no node::Node tree and no node::index_tree.
+    struct TreeIndexIncremental :
+        node::Constants,
+        node::PreLToLabelId,
+        node::PostLToLabelId,
+        node::PreLToSize,
+        node::PostLToSize,
+        node::PreLToParent,
+        node::PostLToParent,
+        node::PostLToLLD,
+        node::PostLToDepth,
+        node::PreLToPostL,
+        node::PostLToPreL,
+        node::PostLToSubtreeMaxDepth
+    {};
+
+    // Builds a node::Node tree from the event stream, for indexes that still need node::index_tree.
+    template <typename Label>
+    class NodeBuilder {
+
+        label::LabelDictionary<Label>& labels_;
+
+        std::optional<node::Node<Label>> tree_;
+        std::vector<std::reference_wrapper<node::Node<Label>>> stack_;
+
+        int next_prel_;
+
+    public:
+
+        NodeBuilder(label::LabelDictionary<Label>& labels);
+
+        void reserve(int capacity);
+        int open(int label_id);
+        void close();
+        void finish();
+
+        const node::Node<Label>& tree() const;
+    };
+
+    template <typename Label>
+    struct SubtreeInsertion {
+        size_t parent;   // old prel of the node the subtree is inserted under
+        size_t position; // number of the parent's surviving old children that precede it
+        node::Node<Label> subtree;
+    };
+
+    struct SubtreeDeletion {
+        size_t root; // old prel
+    };
+
+    template <typename Label>
+    struct Relabel {
+        size_t node; // old prel
+        Label label;
+    };
+
+    template <typename Label>
+    using Edit = std::variant<SubtreeInsertion<Label>, SubtreeDeletion, Relabel<Label>>;
+
+    // Streams t_old with the edits applied into builder, in one linear pass over t_old. Edits are
+    // addressed by old prel and may be given in any order; insertions at the same position keep their
+    // relative order. The root cannot be deleted, and an edit of a node outside t_old throws std::runtime_error.
+    // Returns the preserved-node map (new_prel -> old_prel) for every old node that survived.
+    template <typename Builder, typename TreeIndex, typename Label>
+    std::unordered_map<size_t, size_t> build(
+        const TreeIndex& t_old, Builder& builder,
+        const std::vector<Edit<Label>>& edits,
+        label::LabelDictionary<Label>& labels
+    );
+
+    // The preserved-node map of two consecutive revisions taken as one (new_prel -> old_prel), given
+    // old -> mid and mid -> new: every node preserved by both.
+    std::unordered_map<size_t, size_t> compose(
+        const std::unordered_map<size_t, size_t>& first,
+        const std::unordered_map<size_t, size_t>& second
+    );
+
+    // As build, writing straight into t_new (a distinct index, typically the one retired two revisions
+    // ago) and reusing its storage.
+    template <typename TreeIndex, typename Label>
+    std::unordered_map<size_t, size_t> apply(
+        const TreeIndex& t_old, TreeIndex& t_new,
+        const std::vector<Edit<Label>>& edits,
+        label::LabelDictionary<Label>& labels
+    );
+}
+
+#include "tree-update.imp.hpp"
\ No newline at end of file
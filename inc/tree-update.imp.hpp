@@ -0,0 +1,295 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "tree-update.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+namespace update {
+
+    template <typename TreeIndex>
+    IndexBuilder<TreeIndex>::IndexBuilder(TreeIndex& index) : index_(index), next_prel_(0), next_postl_(0) {}
+
+    template <typename TreeIndex>
+    void IndexBuilder<TreeIndex>::reserve(int capacity) {
+
+        prel_to_postl_.resize(capacity);
+        prel_to_parent_.resize(capacity);
+
+        // resize rather than assign, every slot below the final size is overwritten anyway
+        if constexpr (std::is_base_of_v<node::PreLToLabelId, TreeIndex>) index_.prel_to_label_id_.resize(capacity);
+        if constexpr (std::is_base_of_v<node::PostLToLabelId, TreeIndex>) index_.postl_to_label_id_.resize(capacity);
+        if constexpr (std::is_base_of_v<node::PreLToSize, TreeIndex>) index_.prel_to_size_.resize(capacity);
+        if constexpr (std::is_base_of_v<node::PostLToSize, TreeIndex>) index_.postl_to_size_.resize(capacity);
+        if constexpr (std::is_base_of_v<node::PreLToParent, TreeIndex>) index_.prel_to_parent_.resize(capacity);
+        if constexpr (std::is_base_of_v<node::PostLToParent, TreeIndex>) index_.postl_to_parent_.resize(capacity);
+        if constexpr (std::is_base_of_v<node::PostLToLLD, TreeIndex>) index_.postl_to_lld_.resize(capacity);
+        if constexpr (std::is_base_of_v<node::PostLToDepth, TreeIndex>) index_.postl_to_depth_.resize(capacity);
+        if constexpr (std::is_base_of_v<node::PreLToPostL, TreeIndex>) index_.prel_to_postl_.resize(capacity);
+        if constexpr (std::is_base_of_v<node::PostLToPreL, TreeIndex>) index_.postl_to_prel_.resize(capacity);
+        if constexpr (std::is_base_of_v<node::PostLToSubtreeMaxDepth, TreeIndex>) index_.postl_to_subtree_max_depth_.resize(capacity);
+    }
+
+    template <typename TreeIndex>
+    int IndexBuilder<TreeIndex>::open(int label_id) {
+
+        const int prel = next_prel_++;
+
+        prel_to_parent_[prel] = stack_.empty() ? -1 : stack_.back().prel;
+
+        if constexpr (std::is_base_of_v<node::PreLToLabelId, TreeIndex>) index_.prel_to_label_id_[prel] = label_id;
+        if constexpr (std::is_base_of_v<node::PreLToParent, TreeIndex>) index_.prel_to_parent_[prel] = prel_to_parent_[prel];
+
+        const int depth = stack_.size();
+        stack_.push_back({ prel, label_id, depth });
+
+        return prel;
+    }
+
+    template <typename TreeIndex>
+    void IndexBuilder<TreeIndex>::close() {
+
+        const auto [prel, label_id, max_depth] = stack_.back();
+        const int postl = next_postl_++;
+        const int size = next_prel_ - prel;
+        const int depth = stack_.size() - 1;
+
+        stack_.pop_back();
+        if (!stack_.empty()) stack_.back().max_depth = std::max(stack_.back().max_depth, max_depth);
+
+        prel_to_postl_[prel] = postl;
+
+        if constexpr (std::is_base_of_v<node::PostLToLabelId, TreeIndex>) index_.postl_to_label_id_[postl] = label_id;
+        if constexpr (std::is_base_of_v<node::PreLToSize, TreeIndex>) index_.prel_to_size_[prel] = size;
+        if constexpr (std::is_base_of_v<node::PostLToSize, TreeIndex>) index_.postl_to_size_[postl] = size;
+        if constexpr (std::is_base_of_v<node::PostLToLLD, TreeIndex>) index_.postl_to_lld_[postl] = postl - size + 1;
+        if constexpr (std::is_base_of_v<node::PostLToDepth, TreeIndex>) index_.postl_to_depth_[postl] = depth;
+        if constexpr (std::is_base_of_v<node::PreLToPostL, TreeIndex>) index_.prel_to_postl_[prel] = postl;
+        if constexpr (std::is_base_of_v<node::PostLToPreL, TreeIndex>) index_.postl_to_prel_[postl] = prel;
+        if constexpr (std::is_base_of_v<node::PostLToSubtreeMaxDepth, TreeIndex>) index_.postl_to_subtree_max_depth_[postl] = max_depth;
+    }
+
+    template <typename TreeIndex>
+    void IndexBuilder<TreeIndex>::finish() {
+
+        while (!stack_.empty()) close();
+
+        const int size = next_prel_;
+
+        index_.tree_size_ = size;
+
+        // parents always close after their children, so this has to wait for every postl
+        if constexpr (std::is_base_of_v<node::PostLToParent, TreeIndex>) {
+            for (int prel = 0; prel < size; ++prel) {
+                const int parent = prel_to_parent_[prel];
+                index_.postl_to_parent_[prel_to_postl_[prel]] = parent < 0 ? -1 : prel_to_postl_[parent];
+            }
+        }
+
+        if constexpr (std::is_base_of_v<node::PreLToLabelId, TreeIndex>) index_.prel_to_label_id_.resize(size);
+        if constexpr (std::is_base_of_v<node::PostLToLabelId, TreeIndex>) index_.postl_to_label_id_.resize(size);
+        if constexpr (std::is_base_of_v<node::PreLToSize, TreeIndex>) index_.prel_to_size_.resize(size);
+        if constexpr (std::is_base_of_v<node::PostLToSize, TreeIndex>) index_.postl_to_size_.resize(size);
+        if constexpr (std::is_base_of_v<node::PreLToParent, TreeIndex>) index_.prel_to_parent_.resize(size);
+        if constexpr (std::is_base_of_v<node::PostLToParent, TreeIndex>) index_.postl_to_parent_.resize(size);
+        if constexpr (std::is_base_of_v<node::PostLToLLD, TreeIndex>) index_.postl_to_lld_.resize(size);
+        if constexpr (std::is_base_of_v<node::PostLToDepth, TreeIndex>) index_.postl_to_depth_.resize(size);
+        if constexpr (std::is_base_of_v<node::PreLToPostL, TreeIndex>) index_.prel_to_postl_.resize(size);
+        if constexpr (std::is_base_of_v<node::PostLToPreL, TreeIndex>) index_.postl_to_prel_.resize(size);
+        if constexpr (std::is_base_of_v<node::PostLToSubtreeMaxDepth, TreeIndex>) index_.postl_to_subtree_max_depth_.resize(size);
+    }
+
+    template <typename Label>
+    NodeBuilder<Label>::NodeBuilder(label::LabelDictionary<Label>& labels) : labels_(labels), next_prel_(0) {}
+
+    template <typename Label>
+    void NodeBuilder<Label>::reserve(int) {
+        // nodes are allocated as they're opened
+    }
+
+    template <typename Label>
+    int NodeBuilder<Label>::open(int label_id) {
+        if (stack_.empty()) stack_.push_back(std::ref(tree_.emplace(labels_.get(label_id))));
+        else stack_.push_back(std::ref(stack_.back().get().add_child(node::Node<Label>(labels_.get(label_id)))));
+        return next_prel_++;
+    }
+
+    template <typename Label>
+    void NodeBuilder<Label>::close() {
+        stack_.pop_back();
+    }
+
+    template <typename Label>
+    void NodeBuilder<Label>::finish() {
+        stack_.clear();
+    }
+
+    template <typename Label>
+    const node::Node<Label>& NodeBuilder<Label>::tree() const {
+        return tree_.value();
+    }
+
+    template <typename Builder, typename TreeIndex, typename Label>
+    std::unordered_map<size_t, size_t> build(
+        const TreeIndex& t_old, Builder& builder,
+        const std::vector<Edit<Label>>& edits,
+        label::LabelDictionary<Label>& labels
+    ) {
+        static_assert(std::is_base_of_v<node::PreLToLabelId, TreeIndex> && std::is_base_of_v<node::PreLToSize, TreeIndex>,
+            "walking the old tree needs prel_to_label_id_ and prel_to_size_");
+
+        const int old_size = t_old.tree_size_;
+
+        constexpr int unchanged = -1;
+        constexpr int deleted = -2;
+
+        std::vector<int> old_prel_to_edit(old_size, unchanged); // deleted, or the new label id
+        std::vector<const SubtreeInsertion<Label>*> insertions;
+        int capacity = old_size;
+
+        // edits built in memory rather than by parser::parse_edits haven't been checked yet
+        auto check = [&](const size_t old_prel) {
+            if (old_prel >= static_cast<size_t>(old_size)) throw std::runtime_error("edit of node " + std::to_string(old_prel) + " beyond the previous revision");
+            return old_prel;
+        };
+
+        for (const auto& edit : edits) {
+            if (auto insertion = std::get_if<SubtreeInsertion<Label>>(&edit)) {
+                check(insertion->parent);
+                insertions.push_back(insertion);
+                capacity += insertion->subtree.get_tree_size();
+            }
+            else if (auto deletion = std::get_if<SubtreeDeletion>(&edit)) {
+                if (check(deletion->root) == 0) throw std::runtime_error("deletion of the root");
+                old_prel_to_edit[deletion->root] = deleted;
+            }
+            else {
+                auto& relabel = std::get<Relabel<Label>>(edit);
+                if (old_prel_to_edit[check(relabel.node)] != deleted) old_prel_to_edit[relabel.node] = labels.insert(relabel.label);
+            }
+        }
+
+        std::stable_sort(insertions.begin(), insertions.end(), [](auto a, auto b) {
+            return a->parent != b->parent ? a->parent < b->parent : a->position < b->position;
+        });
+
+        struct ParentOrder {
+            bool operator()(const SubtreeInsertion<Label>* insertion, size_t parent) const { return insertion->parent < parent; }
+            bool operator()(size_t parent, const SubtreeInsertion<Label>* insertion) const { return parent < insertion->parent; }
+        };
+
+        std::unordered_map<size_t, size_t> preserved;
+        preserved.reserve(old_size);
+
+        builder.reserve(capacity);
+
+        auto insert_subtree = [&](auto& self, const node::Node<Label>& subtree) -> void {
+            builder.open(labels.insert(subtree.label()));
+            for (const auto& child : subtree.get_children()) self(self, child);
+            builder.close();
+        };
+
+        using InsertionIterator = typename std::vector<const SubtreeInsertion<Label>*>::const_iterator;
+
+        struct Frame {
+            int old_end;                      // one past the last old prel in the subtree
+            size_t children;                  // old children passed so far
+            InsertionIterator next_insertion; // pending insertions under this node
+            InsertionIterator end_insertion;
+        };
+
+        std::vector<Frame> frames;
+
+        // emits the insertions under the innermost open node that come before its next old child
+        auto insert_before = [&](const size_t position) {
+            auto& frame = frames.back();
+            while (frame.next_insertion != frame.end_insertion && (*frame.next_insertion)->position <= position) {
+                insert_subtree(insert_subtree, (*frame.next_insertion++)->subtree);
+            }
+        };
+
+        auto close_frame = [&]() {
+            insert_before(std::numeric_limits<size_t>::max());
+            builder.close();
+            frames.pop_back();
+        };
+
+        for (int old_prel = 0; old_prel < old_size;) {
+
+            while (!frames.empty() && frames.back().old_end <= old_prel) close_frame();
+
+            if (!frames.empty()) insert_before(frames.back().children);
+
+            const int edit = old_prel_to_edit[old_prel];
+
+            if (edit == deleted) {
+                old_prel += t_old.prel_to_size_[old_prel];
+                continue;
+            }
+
+            if (!frames.empty()) frames.back().children++;
+
+            preserved.emplace(builder.open(edit == unchanged ? t_old.prel_to_label_id_[old_prel] : edit), old_prel);
+
+            // insertions under deleted nodes are never reached, and so are dropped with them
+            auto [next_insertion, end_insertion] = std::equal_range(insertions.cbegin(), insertions.cend(), static_cast<size_t>(old_prel), ParentOrder());
+            frames.push_back({ old_prel + t_old.prel_to_size_[old_prel], 0, next_insertion, end_insertion });
+
+            old_prel++;
+        }
+
+        while (!frames.empty()) close_frame();
+
+        builder.finish();
+
+        return preserved;
+    }
+
+    template <typename TreeIndex, typename Label>
+    std::unordered_map<size_t, size_t> apply(
+        const TreeIndex& t_old, TreeIndex& t_new,
+        const std::vector<Edit<Label>>& edits,
+        label::LabelDictionary<Label>& labels
+    ) {
+        IndexBuilder<TreeIndex> builder(t_new);
+        return build(t_old, builder, edits, labels);
+    }
+
+    inline std::unordered_map<size_t, size_t> compose(
+        const std::unordered_map<size_t, size_t>& first,
+        const std::unordered_map<size_t, size_t>& second
+    ) {
+        std::unordered_map<size_t, size_t> preserved;
+        preserved.reserve(second.size());
+
+        for (const auto& [new_prel, mid_prel] : second) {
+            auto old_prel = first.find(mid_prel);
+            if (old_prel != first.end()) preserved.emplace(new_prel, old_prel->second);
+        }
+
+        return preserved;
+    }
+}
\ No newline at end of file
@@ -20,9 +20,14 @@
 // SOFTWARE.
 
 #include "parser.hpp"
+#include "tree-update.hpp"
 #include "string_label.h"
 
 #include "touzet-dynamic.hpp"
+#include "dynamic-session.hpp"
+#include "similarity-join.hpp"
+#include "checkpoint.hpp"
+#include "revision-queue.hpp"
 #include "touzet_depth_pruning_truncated_tree_fix_tree_index.h"
 #include "touzet_kr_set_tree_index.h"
 
@@ -31,14 +36,25 @@
 #include "label_dictionary.h"
 
 #include <cstddef>
-#include <iostream>
+#include <cmath>
+#include <cstdio>
 #include <fstream>
+#include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include <chrono>
-
-std::string content_as_string(std::string path) {
-    return std::string((std::stringstream() << std::ifstream(path).rdbuf()).str());
-}
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <limits>
+#include <future>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
 
 std::pair<std::optional<std::string>, std::optional<std::string>> get_new_trees() {
     std::string t1_path, t2_path;
@@ -50,141 +66,598 @@ std::pair<std::optional<std::string>, std::optional<std::string>> get_new_trees(
     );
 }
 
+// the static engines that can be run after each dynamic step, in the order they're reported
+constexpr std::array<const char*, 4> reference_flags = {"bounded-topdiff", "bounded-touzet", "topdiff", "touzet"};
+constexpr std::array<const char*, 4> reference_names = {"Bounded TopDiff", "Bounded Touzet", "Bound-Finding TopDiff", "Bound-Finding Touzet"};
+
+struct ReferenceResult {
+    double distance;
+    long long int problems;
+    double millis;
+};
+
+template <typename Engine, typename Run>
+ReferenceResult timed(Engine& engine, Run&& run) {
+    auto start = std::chrono::high_resolution_clock::now();
+    double distance = run(engine);
+    auto stop = std::chrono::high_resolution_clock::now();
+    return {distance, engine.get_subproblem_count(), std::chrono::duration<double, std::milli>(stop - start).count()};
+}
+
+// Writes the mapping the dynamic engine last backtraced as a JSON line, in preorder ids: pairs whose labels
+// match, pairs renamed, and the nodes deleted from t1 and inserted into t2. Beyond a threshold, only the
+// distance (as null).
+template <typename Engine>
+void write_mapping(std::ostream& out, const int step, const double distance, const Engine& engine, const update::TreeIndexIncremental& t1, const update::TreeIndexIncremental& t2) {
+
+    out << "{\"step\": " << step << ", \"distance\": ";
+    if (std::isinf(distance)) {
+        out << "null}" << std::endl;
+        return;
+    }
+    out << distance;
+
+    std::vector<std::pair<int, int>> mapped, renamed;
+    std::vector<bool> t1_mapped(t1.tree_size_), t2_mapped(t2.tree_size_);
+    for (const auto& [x, y] : engine.mapping().pairs()) {
+        t1_mapped[x] = t2_mapped[y] = true;
+        auto& kind = t1.postl_to_label_id_[x] == t2.postl_to_label_id_[y] ? mapped : renamed;
+        kind.emplace_back(t1.postl_to_prel_[x], t2.postl_to_prel_[y]);
+    }
+    std::sort(mapped.begin(), mapped.end());
+    std::sort(renamed.begin(), renamed.end());
+
+    auto write_pairs = [&](const char* name, const std::vector<std::pair<int, int>>& pairs) {
+        out << ", \"" << name << "\": [";
+        for (size_t pair = 0; pair < pairs.size(); ++pair) out << (pair ? ", [" : "[") << pairs[pair].first << ", " << pairs[pair].second << "]";
+        out << "]";
+    };
+
+    // unmapped nodes, in preorder
+    auto write_nodes = [&](const char* name, const update::TreeIndexIncremental& t, const std::vector<bool>& is_mapped) {
+        out << ", \"" << name << "\": [";
+        bool first = true;
+        for (int prel = 0; prel < t.tree_size_; ++prel) {
+            if (is_mapped[t.prel_to_postl_[prel]]) continue;
+            out << (first ? "" : ", ") << prel;
+            first = false;
+        }
+        out << "]";
+    };
+
+    write_pairs("mapped", mapped);
+    write_pairs("renamed", renamed);
+    write_nodes("deleted", t1, t1_mapped);
+    write_nodes("inserted", t2, t2_mapped);
+    out << "}" << std::endl;
+}
+
+// Session mode tracks many pairs over a shared set of trees. Commands, one per line on stdin:
+//   add <tree> <path>            registers a tree
+//   revise <tree> <path>         stages the tree's next revision (bracket file or edit script)
+//   track <pair> <tree> <tree>   starts tracking a pair, computed from scratch on the next commit
+//   untrack <pair>
+//   commit                       updates every affected pair, then makes the staged revisions current
+template <typename CostModel, typename ReadTree, typename ReadRevision>
+int run_session(const ted::DynamicTozuetTreeIndex<CostModel, update::TreeIndexIncremental>& settings, const CostModel& model, ReadTree&& read_tree, ReadRevision&& read_revision) {
+
+    ted::DynamicSession<CostModel, update::TreeIndexIncremental> session(model);
+    session.engine().adaptive_bound = settings.adaptive_bound;
+    session.engine().threads = settings.threads;
+    session.engine().prune_retained = settings.prune_retained;
+    session.engine().extend_band = settings.extend_band;
+    session.engine().hash_subtrees = settings.hash_subtrees;
+    session.engine().lazy = settings.lazy;
+    session.engine().threshold = settings.threshold;
+
+    std::cout << "Tree: Distance, Subproblems (trees + forests), Time (milliseconds)" << std::endl;
+    std::cout << "Pair: Distance, Subproblems (trees + forests), Time (milliseconds), Hit (tree pairs), Missed (tree pairs), Band (initial k, final k)" << std::endl;
+
+    std::string line;
+    while (std::getline(std::cin, line)) {
+
+        std::istringstream command(line);
+        std::string op, id;
+        command >> op >> id;
+
+        try {
+            if (op == "add") {
+                std::string path;
+                command >> path;
+                update::TreeIndexIncremental t;
+                read_tree(path, t);
+                session.add_tree(id, std::move(t));
+            }
+            else if (op == "revise") {
+                std::string path;
+                command >> path;
+                update::TreeIndexIncremental t;
+                auto preserved_nodes = read_revision(path, session.tree(id), t);
+                session.revise_tree(id, std::move(t), preserved_nodes);
+                auto& revision = session.revision(id);
+                std::cout << id << ": " << revision.d << " " << revision.problems << " " << revision.millis << std::endl;
+            }
+            else if (op == "track") {
+                std::string t1, t2;
+                command >> t1 >> t2;
+                session.track(id, t1, t2);
+            }
+            else if (op == "untrack") session.untrack(id);
+            else if (op == "commit") {
+                session.commit([](const std::string& id, const auto& engine) {
+                    std::cout << id << ": " << engine.d_old_ << " " << engine.get_subproblem_count() << " " << engine.ted_millis << " " << engine.hit << " " << engine.missed << " " << engine.k_initial_ << " " << engine.k_old_ << std::endl;
+                });
+            }
+            else if (!op.empty()) throw std::runtime_error("Unknown command: " + op);
+        }
+        catch (const std::runtime_error& error) {
+            std::cerr << error.what() << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Join mode keeps every pair of a collection of trees within --threshold up to date. Commands, one per line
+// on stdin:
+//   add <tree> <path>            registers a tree, joined against the others on the next commit
+//   revise <tree> <path>         stages the tree's next revision (bracket file or edit script)
+//   commit                       re-joins every new or revised tree, then makes the staged revisions current
+// A commit reports every pair that came within the threshold, moved within it or left it (as inf), then a
+// line of the pairs it considered, filtered out, verified and verified from a retained band.
+template <typename CostModel, typename ReadTree, typename ReadRevision>
+int run_join(const ted::DynamicTozuetTreeIndex<CostModel, update::TreeIndexIncremental>& settings, const CostModel& model, ReadTree&& read_tree, ReadRevision&& read_revision) {
+
+    ted::SimilarityJoin<CostModel, update::TreeIndexIncremental> join(model, settings.threshold);
+    join.engine().adaptive_bound = settings.adaptive_bound;
+    join.engine().threads = settings.threads;
+    join.engine().prune_retained = settings.prune_retained;
+    join.engine().extend_band = settings.extend_band;
+    join.engine().hash_subtrees = settings.hash_subtrees;
+    join.engine().lazy = settings.lazy;
+
+    std::cout << "Tree: Distance, Subproblems (trees + forests), Time (milliseconds)" << std::endl;
+    std::cout << "Pair: Distance" << std::endl;
+    std::cout << "Commit: Candidates (pairs), Filtered (pairs), Verified (pairs), Retained (pairs)" << std::endl;
+
+    std::string line;
+    while (std::getline(std::cin, line)) {
+
+        std::istringstream command(line);
+        std::string op, id;
+        command >> op >> id;
+
+        try {
+            if (op == "add") {
+                std::string path;
+                command >> path;
+                update::TreeIndexIncremental t;
+                read_tree(path, t);
+                join.add_tree(id, std::move(t));
+            }
+            else if (op == "revise") {
+                std::string path;
+                command >> path;
+                update::TreeIndexIncremental t;
+                auto preserved_nodes = read_revision(path, join.tree(id), t);
+                join.revise_tree(id, std::move(t), preserved_nodes);
+                auto& revision = join.revision(id);
+                std::cout << id << ": " << revision.d << " " << revision.problems << " " << revision.millis << std::endl;
+            }
+            else if (op == "commit") {
+                join.commit([](const std::string& t1, const std::string& t2, const double distance) {
+                    std::cout << t1 << " " << t2 << ": " << distance << std::endl;
+                });
+                std::cout << "Commit: " << join.candidates << " " << join.filtered << " " << join.verified << " " << join.retained << std::endl;
+            }
+            else if (!op.empty()) throw std::runtime_error("Unknown command: " + op);
+        }
+        catch (const std::runtime_error& error) {
+            std::cerr << error.what() << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
 
     label::LabelDictionary<label::StringLabel> labels;
     cost_model::UnitCostModelLD<label::StringLabel> model(labels);
 
-    ted::TouzetKRSetTreeIndex<cost_model::UnitCostModelLD<label::StringLabel>, node::TreeIndexAll> topdiff(model);
-    ted::TouzetDepthPruningTruncatedTreeFixTreeIndex<cost_model::UnitCostModelLD<label::StringLabel>, node::TreeIndexAll> touzet(model);
-    ted::DynamicTozuetTreeIndex<cost_model::UnitCostModelLD<label::StringLabel>, node::TreeIndexAll> dynamic_ted(model);
+    // one instance per reference engine, so that they can run concurrently under --verify
+    ted::TouzetKRSetTreeIndex<cost_model::UnitCostModelLD<label::StringLabel>, node::TreeIndexAll> bounded_topdiff(model), topdiff(model);
+    ted::TouzetDepthPruningTruncatedTreeFixTreeIndex<cost_model::UnitCostModelLD<label::StringLabel>, update::TreeIndexIncremental> bounded_touzet(model), touzet(model);
+    ted::DynamicTozuetTreeIndex<cost_model::UnitCostModelLD<label::StringLabel>, update::TreeIndexIncremental> dynamic_ted(model);
+
+    // each tree's current revision, and the storage its next one is read into; under --verify the references
+    // share the revision they're checking rather than a copy of it
+    auto t1_old = std::make_shared<update::TreeIndexIncremental>(), t2_old = std::make_shared<update::TreeIndexIncremental>();
+    auto t1_new = std::make_shared<update::TreeIndexIncremental>(), t2_new = std::make_shared<update::TreeIndexIncremental>();
+
+    bool edit_scripts = false;
+    bool session_mode = false;
+    bool join_mode = false;
+    bool verify = false;
+    std::ofstream instrumentation, mapping;
+    std::string checkpoint_path, restore_path;
+    int checkpoint_steps = 0;
+    double checkpoint_seconds = 0;
+    std::optional<double> latency_target;
+    std::array<bool, reference_flags.size()> references = {true, true, true, true};
+
+    for (int arg = 1; arg < argc; ++arg) {
+        if (std::string(argv[arg]) == "--adaptive-bound") dynamic_ted.adaptive_bound = true;
+        else if (std::string(argv[arg]) == "--edit-scripts") edit_scripts = true;
+        else if (std::string(argv[arg]) == "--session") session_mode = true;
+        else if (std::string(argv[arg]) == "--join") join_mode = true;
+        else if (std::string(argv[arg]) == "--prune-retained") dynamic_ted.prune_retained = true;
+        else if (std::string(argv[arg]) == "--extend-band") dynamic_ted.extend_band = true;
+        else if (std::string(argv[arg]) == "--hash-subtrees") dynamic_ted.hash_subtrees = true;
+        else if (std::string(argv[arg]) == "--lazy") dynamic_ted.lazy = true;
+        else if (std::string(argv[arg]) == "--threads" && arg + 1 < argc) dynamic_ted.threads = std::stoi(argv[++arg]);
+        else if (std::string(argv[arg]) == "--threshold" && arg + 1 < argc) dynamic_ted.threshold = std::stod(argv[++arg]);
+        else if (std::string(argv[arg]) == "--verify") verify = true;
+        else if (std::string(argv[arg]) == "--checkpoint" && arg + 1 < argc) checkpoint_path = argv[++arg];
+        else if (std::string(argv[arg]) == "--checkpoint-steps" && arg + 1 < argc) checkpoint_steps = std::stoi(argv[++arg]);
+        else if (std::string(argv[arg]) == "--checkpoint-seconds" && arg + 1 < argc) checkpoint_seconds = std::stod(argv[++arg]);
+        else if (std::string(argv[arg]) == "--restore" && arg + 1 < argc) restore_path = argv[++arg];
+        else if (std::string(argv[arg]) == "--latency-target" && arg + 1 < argc) latency_target = std::stod(argv[++arg]);
+        else if (std::string(argv[arg]) == "--edit-mapping" && arg + 1 < argc) {
+            dynamic_ted.edit_mapping = true;
+            mapping.open(argv[++arg]);
+        }
+        else if (std::string(argv[arg]) == "--instrumentation" && arg + 1 < argc) {
+            if (!ted::instrumented) {
+                std::cerr << "--instrumentation needs a build with TED_INSTRUMENT (make INSTRUMENT=1)" << std::endl;
+                return 1;
+            }
+            instrumentation.open(argv[++arg]);
+        }
+        else if (std::string(argv[arg]) == "--engines" && arg + 1 < argc) {
+            references.fill(false);
+            std::istringstream list(argv[++arg]);
+            std::string name;
+            while (std::getline(list, name, ',')) {
+                auto flag = std::find_if(reference_flags.begin(), reference_flags.end(), [&](const char* flag) { return name == flag; });
+                if (flag != reference_flags.end()) references[flag - reference_flags.begin()] = true;
+                else if (name != "none") {
+                    std::cerr << "Unknown engine: " << name << std::endl;
+                    return 1;
+                }
+            }
+        }
+        else {
+            std::cerr << "Unknown argument: " << argv[arg] << std::endl;
+            return 1;
+        }
+    }
 
-    node::TreeIndexAll t1_old, t2_old;
+    if ((checkpoint_steps > 0 || checkpoint_seconds > 0) && checkpoint_path.empty()) {
+        std::cerr << "--checkpoint-steps and --checkpoint-seconds need --checkpoint" << std::endl;
+        return 1;
+    }
 
-    // TODO: add flags to enable / disable the Offline and Static algorithms
+    // the reader thread polls stdin before each read, which only sees input stdio hasn't buffered yet
+    if (latency_target.has_value()) std::setvbuf(stdin, nullptr, _IONBF, 0);
+
+    parser::LabelInterner<label::StringLabel> interner(labels);
+
+    auto parse_tree = [&](std::string_view source, update::TreeIndexIncremental& t) {
+        update::IndexBuilder builder(t);
+        parser::parse_into(source, builder, interner);
+    };
+
+    auto read_tree = [&](const std::string& path, update::TreeIndexIncremental& t) {
+        parser::MappedFile file(path);
+        parse_tree(file.view(), t);
+    };
+
+    // reads the next revision of a tree into t_new, reusing its storage, and returns its preserved nodes
+    // (new_prel -> old_prel)
+    auto read_revision = [&](const std::string& path, const update::TreeIndexIncremental& t_old, update::TreeIndexIncremental& t_new) {
+        parser::MappedFile file(path);
+        if (edit_scripts) return update::apply(t_old, t_new, parser::parse_edits<label::StringLabel>(file.view(), t_old.tree_size_), labels);
+        update::IndexBuilder builder(t_new);
+        return parser::parse_into(file.view(), builder, interner, t_old.prel_to_label_id_);
+    };
+
+    if (session_mode) return run_session(dynamic_ted, model, read_tree, read_revision);
+    if (join_mode) return run_join(dynamic_ted, model, read_tree, read_revision);
+
+    // The TopDiff references need the KR sets only node::index_tree computes, so when either runs, a step's
+    // trees are rebuilt and reindexed for them. That's kept off the dynamic engine's path, and on this
+    // thread, since indexing looks labels up in the dictionary the parser is adding to.
+    const bool index_all = references[0] || references[2];
+    using TreesAll = std::pair<node::TreeIndexAll, node::TreeIndexAll>;
+
+    auto reindex = [&](const update::TreeIndexIncremental& t1, const update::TreeIndexIncremental& t2) {
+        TreesAll trees;
+        if (!index_all) return trees;
+        for (auto [t, t_all] : {std::pair{&t1, &trees.first}, std::pair{&t2, &trees.second}}) {
+            update::NodeBuilder<label::StringLabel> builder(labels);
+            update::build(*t, builder, std::vector<update::Edit<label::StringLabel>>(), labels);
+            node::index_tree(*t_all, builder.tree(), labels, model);
+        }
+        return trees;
+    };
+
+    // runs a reference engine on t1 / t2 (or on trees_all, their reindexed copies), the bounded ones within k
+    auto run_reference = [&](std::size_t reference, const update::TreeIndexIncremental& t1, const update::TreeIndexIncremental& t2, const TreesAll& trees_all, int k) {
+        switch (reference) {
+            case 0: return timed(bounded_topdiff, [&](auto& engine) { return engine.ted_k(trees_all.first, trees_all.second, k); });
+            case 1: return timed(bounded_touzet, [&](auto& engine) { return engine.ted_k(t1, t2, k); });
+            case 2: return timed(topdiff, [&](auto& engine) { return engine.ted(trees_all.first, trees_all.second); });
+            default: return timed(touzet, [&](auto& engine) { return engine.ted(t1, t2); });
+        }
+    };
 
-    {
-        auto [t1_path, t2_path] = get_new_trees();
-        if (t1_path.has_value() && t2_path.has_value()) {
+    // under --verify, the references for the previous step, sharing its trees
+    struct Verification {
+        int step;
+        double distance;
+        std::array<std::future<ReferenceResult>, reference_flags.size()> results;
+    };
+
+    std::optional<Verification> pending;
+    bool verified = true;
+
+    auto finish_verification = [&]() {
+        if (!pending.has_value()) return;
+        for (std::size_t reference = 0; reference < references.size(); ++reference) {
+            if (!references[reference]) continue;
+            auto result = pending->results[reference].get();
+            std::cout << "Verify " << pending->step << " " << reference_names[reference] << ": " << result.distance << " " << result.problems << " " << result.millis << std::endl;
+            // under a threshold, only whether the distance is within it
+            const double expected = result.distance <= dynamic_ted.threshold ? result.distance : std::numeric_limits<double>::infinity();
+            if (expected != pending->distance) {
+                std::cerr << "Step " << pending->step << ": " << reference_names[reference] << " found " << result.distance << " but Dynamic Touzet found " << pending->distance << std::endl;
+                verified = false;
+            }
+        }
+        pending.reset();
+    };
+
+    if (!restore_path.empty()) {
 
+        // carries on from a checkpoint in place of the first two trees and the baseline
+        try {
             auto start = std::chrono::high_resolution_clock::now();
-            node::index_tree(t1_old, parser::parse<label::StringLabel>(content_as_string(t1_path.value())), labels, model);
+            ted::Checkpoint checkpoint(restore_path);
+            parse_tree(checkpoint.t1(), *t1_old);
+            parse_tree(checkpoint.t2(), *t2_old);
+            checkpoint.restore(dynamic_ted, *t1_old, *t2_old);
             auto stop = std::chrono::high_resolution_clock::now();
-            std::cerr << "Parsing + Indexing Tree 1 took " << std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << "ms" << std::endl;
 
-            start = std::chrono::high_resolution_clock::now();
-            node::index_tree(t2_old, parser::parse<label::StringLabel>(content_as_string(t2_path.value())), labels, model);
-            stop = std::chrono::high_resolution_clock::now();
-            std::cerr << "Parsing + Indexing Tree 2 took " << std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << "ms" << std::endl;
+            std::cout << "Instance: Distance, Subproblems (trees + forests), Time (milliseconds), Hit (tree pairs), Missed (tree pairs), Band (initial k, final k)" << std::endl;
+            std::cout << "Baseline: " << dynamic_ted.d_old_ << " 0 " << std::chrono::duration<double, std::milli>(stop - start).count() << std::endl;
+        }
+        catch (const std::runtime_error& error) {
+            std::cerr << error.what() << std::endl;
+            return 1;
+        }
+    }
+    else {
+        auto [t1_path, t2_path] = get_new_trees();
+        if (t1_path.has_value() && t2_path.has_value()) {
+
+            try {
+                auto start = std::chrono::high_resolution_clock::now();
+                read_tree(t1_path.value(), *t1_old);
+                auto stop = std::chrono::high_resolution_clock::now();
+                std::cerr << "Parsing + Indexing Tree 1 took " << std::chrono::duration<double, std::milli>(stop - start).count() << "ms" << std::endl;
+
+                start = std::chrono::high_resolution_clock::now();
+                read_tree(t2_path.value(), *t2_old);
+                stop = std::chrono::high_resolution_clock::now();
+                std::cerr << "Parsing + Indexing Tree 2 took " << std::chrono::duration<double, std::milli>(stop - start).count() << "ms" << std::endl;
+            }
+            catch (const std::runtime_error& error) {
+                std::cerr << error.what() << std::endl;
+                return 1;
+            }
         }
         else {
             std::cerr << "First two trees must be provided" << std::endl;
             return 1;
         }
 
-        std::cout << "Instance: Distance, Subproblems (trees + forests), Time (milliseconds), Hit (tree pairs), Missed (tree pairs)" << std::endl;
+        std::cout << "Instance: Distance, Subproblems (trees + forests), Time (milliseconds), Hit (tree pairs), Missed (tree pairs), Band (initial k, final k)" << std::endl;
 
-        std::cout << "Baseline: " << dynamic_ted.ted(t1_old, t2_old) << " " << dynamic_ted.get_subproblem_count() << " " << dynamic_ted.ted_millis << std::endl;
+        const double distance = dynamic_ted.ted(*t1_old, *t2_old);
+        std::cout << "Baseline: " << distance << " " << dynamic_ted.get_subproblem_count() << " " << dynamic_ted.ted_millis << std::endl;
+        if (mapping.is_open()) write_mapping(mapping, 0, distance, dynamic_ted, *t1_old, *t2_old);
+    }
+
+    // reads a tree's revisions in turn, returning their preserved nodes composed into one map against t_old
+    update::TreeIndexIncremental t_next;
+    auto read_revisions = [&](const std::vector<std::string>& paths, const update::TreeIndexIncremental& t_old, update::TreeIndexIncremental& t_new) {
+        auto preserved_nodes = read_revision(paths.front(), t_old, t_new);
+        for (std::size_t next = 1; next < paths.size(); ++next) {
+            preserved_nodes = update::compose(preserved_nodes, read_revision(paths[next], t_new, t_next));
+            std::swap(t_new, t_next);
+        }
+        return preserved_nodes;
+    };
+
+    // the storage of a tree's previous revision, unless a reference is still verifying it
+    auto recycle = [](std::shared_ptr<update::TreeIndexIncremental>& t) -> update::TreeIndexIncremental& {
+        if (t.use_count() > 1) t = std::make_shared<update::TreeIndexIncremental>();
+        return *t;
+    };
+
+    // under --latency-target, the paths are read from stdin as they arrive, and revisions that queue up
+    // behind a slow step are coalesced into the next one
+    using Paths = std::pair<std::optional<std::string>, std::optional<std::string>>;
+    std::unique_ptr<ted::RevisionQueue<Paths>> queue;
+    std::thread reader;
+    std::atomic<bool> stop_reading = false;
+
+    // joins the reader, which would otherwise go on pushing into the queue after main returns
+    auto stop_reader = [&]() {
+        stop_reading = true;
+        if (reader.joinable()) reader.join();
+    };
+
+    if (latency_target.has_value()) {
+        queue = std::make_unique<ted::RevisionQueue<Paths>>(latency_target.value());
+        reader = std::thread([&queue, &stop_reading]() {
+            // waits for the next revision in short polls rather than blocking in getline, so it can be stopped
+            auto input = [&]() {
+                pollfd in = { STDIN_FILENO, POLLIN, 0 };
+                while (!stop_reading) if (::poll(&in, 1, 100) != 0) return true;
+                return false;
+            };
+            while (input()) {
+                auto paths = get_new_trees();
+                if (!paths.first.has_value() && !paths.second.has_value()) break;
+                queue->push(std::move(paths));
+            }
+            queue->close();
+        });
+        std::cout << "Queue: Revisions (this step), Waited (milliseconds), Coalesced (revisions so far)" << std::endl;
     }
 
-    while (true) {
+    // under --checkpoint-steps / --checkpoint-seconds, when the last checkpoint was saved mid-run
+    int checkpoint_step = 0;
+    auto checkpoint_time = std::chrono::steady_clock::now();
+
+    for (int step = 1;; ++step) {
 
         std::unordered_map<size_t, size_t> t1_preserved_nodes, t2_preserved_nodes;
-        node::TreeIndexAll t1_new, t2_new;
 
-        auto [t1_path, t2_path] = get_new_trees();
+        // the revisions this step computes, oldest first; none once the input ends
+        std::vector<Paths> revisions;
+        if (queue) revisions = queue->take();
+        else if (auto paths = get_new_trees(); paths.first.has_value() || paths.second.has_value()) revisions.push_back(std::move(paths));
 
-        if (t1_path.has_value()) {
+        // steps are numbered by the last revision they compute
+        if (revisions.size() > 1) step += revisions.size() - 1;
 
-            auto start = std::chrono::high_resolution_clock::now();
+        std::vector<std::string> t1_paths, t2_paths;
+        for (auto& [t1_path, t2_path] : revisions) {
+            if (t1_path.has_value()) t1_paths.push_back(std::move(t1_path.value()));
+            if (t2_path.has_value()) t2_paths.push_back(std::move(t2_path.value()));
+        }
 
-            auto [t1, t1_retained] = parser::parse<label::StringLabel>(
-                content_as_string(t1_path.value()),
-                [&labels, &t1_old](size_t prel) {
-                    return labels.get(t1_old.prel_to_label_id_[prel]);
-                }
-            );
-            node::index_tree(t1_new, t1, labels, model);
+        try {
+            if (!t1_paths.empty()) {
 
-            auto stop = std::chrono::high_resolution_clock::now();
+                auto start = std::chrono::high_resolution_clock::now();
 
-            std::cerr << "Parsing + Indexing Tree 1 took " << std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << "ms" << std::endl;
+                t1_preserved_nodes = read_revisions(t1_paths, *t1_old, recycle(t1_new));
 
-            t1_preserved_nodes = t1_retained;
-        }
-        else std::cerr << "Tree 1 is unchanged..." << std::endl;
+                auto stop = std::chrono::high_resolution_clock::now();
 
-        if (t2_path.has_value()) {
+                std::cerr << "Parsing + Indexing Tree 1 took " << std::chrono::duration<double, std::milli>(stop - start).count() << "ms" << std::endl;
+            }
+            else std::cerr << "Tree 1 is unchanged..." << std::endl;
 
-            auto start = std::chrono::high_resolution_clock::now();
+            if (!t2_paths.empty()) {
 
-            auto [t2, t2_retained] = parser::parse<label::StringLabel>(
-                content_as_string(t2_path.value()),
-                [&labels, &t2_old](size_t prel) {
-                    return labels.get(t2_old.prel_to_label_id_[prel]);
-                }
-            );
-            node::index_tree(t2_new, t2, labels, model);
+                auto start = std::chrono::high_resolution_clock::now();
 
-            auto stop = std::chrono::high_resolution_clock::now();
+                t2_preserved_nodes = read_revisions(t2_paths, *t2_old, recycle(t2_new));
 
-            std::cerr << "Parsing + Indexing Tree 2 took " << std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count() << "ms" << std::endl;
+                auto stop = std::chrono::high_resolution_clock::now();
 
-            t2_preserved_nodes = t2_retained;
+                std::cerr << "Parsing + Indexing Tree 2 took " << std::chrono::duration<double, std::milli>(stop - start).count() << "ms" << std::endl;
+            }
+            else std::cerr << "Tree 2 is unchanged..." << std::endl;
+        }
+        catch (const std::runtime_error& error) {
+            std::cerr << error.what() << std::endl;
+            stop_reader();
+            return 1;
         }
-        else std::cerr << "Tree 2 is unchanged..." << std::endl;
 
         double distance;
 
-        if (t1_path.has_value() && t2_path.has_value()) {
+        if (!t1_paths.empty() && !t2_paths.empty()) {
 
-            distance = dynamic_ted.ted(t1_old, t1_new, t1_preserved_nodes, t2_old, t2_new, t2_preserved_nodes);
-            t1_old = t1_new;
-            t2_old = t2_new;
+            distance = dynamic_ted.ted(*t1_old, *t1_new, t1_preserved_nodes, *t2_old, *t2_new, t2_preserved_nodes);
+            std::swap(t1_old, t1_new);
+            std::swap(t2_old, t2_new);
 
         }
-        else if (t1_path.has_value()) {
+        else if (!t1_paths.empty()) {
 
-            distance = dynamic_ted.ted(t1_old, t1_new, t1_preserved_nodes, t2_old);
-            t1_old = t1_new;
+            distance = dynamic_ted.ted(*t1_old, *t1_new, t1_preserved_nodes, *t2_old);
+            std::swap(t1_old, t1_new);
 
         }
-        else if (t2_path.has_value()) {
+        else if (!t2_paths.empty()) {
 
-            distance = dynamic_ted.ted(t1_old, t2_old, t2_new, t2_preserved_nodes);
-            t2_old = t2_new;
+            distance = dynamic_ted.ted(*t1_old, *t2_old, *t2_new, t2_preserved_nodes);
+            std::swap(t2_old, t2_new);
 
         }
-        else  return 0;
+        else {
+            stop_reader();
+            finish_verification();
+            if (!checkpoint_path.empty()) {
+                try {
+                    ted::Checkpoint::save(checkpoint_path, dynamic_ted, *t1_old, *t2_old, labels);
+                }
+                catch (const std::runtime_error& error) {
+                    std::cerr << error.what() << std::endl;
+                    return 1;
+                }
+            }
+            return verified ? 0 : 1;
+        }
 
         std::cout << "T1 Preprocessing: " << dynamic_ted.t1_d_ << " " << dynamic_ted.t1_prep_problems << " " << dynamic_ted.t1_prep_millis << std::endl;
         std::cout << "T2 Preprocessing: " << dynamic_ted.t2_d_ << " " << dynamic_ted.t2_prep_problems << " " << dynamic_ted.t2_prep_millis << std::endl;
-        std::cout << "Dynamic Touzet: " << dynamic_ted.d_old_ << " " << dynamic_ted.get_subproblem_count() << " " << dynamic_ted.ted_millis << " " << dynamic_ted.hit << " " << dynamic_ted.missed << std::endl;
+        std::cout << "Dynamic Touzet: " << distance << " " << dynamic_ted.get_subproblem_count() << " " << dynamic_ted.ted_millis << " " << dynamic_ted.hit << " " << dynamic_ted.missed << " " << dynamic_ted.k_initial_ << " " << dynamic_ted.k_old_ << std::endl;
+        if (queue) std::cout << "Queue: " << revisions.size() << " " << queue->waited_millis << " " << queue->coalesced << std::endl;
+        if (instrumentation.is_open()) {
+            instrumentation << "{\"step\": " << step << ", ";
+            dynamic_ted.instrumentation.write(instrumentation);
+            instrumentation << "}" << std::endl;
+        }
+        if (mapping.is_open()) write_mapping(mapping, step, distance, dynamic_ted, *t1_old, *t2_old);
+
         std::cerr << "Hit " << ((double)dynamic_ted.hit / (double)(dynamic_ted.hit + dynamic_ted.missed)) * 100.0 << "% of subtree pairs" << std::endl;
 
-        auto start = std::chrono::high_resolution_clock::now();
-        distance = topdiff.ted_k(t1_old, t2_old, dynamic_ted.k_old_);
-        auto stop = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
-        std::cout << "Bounded TopDiff: " << distance << " " << topdiff.get_subproblem_count() << " " << duration << std::endl; // << normal_topdiff.td_.get_band_width() << std::endl;
-
-        start = std::chrono::high_resolution_clock::now();
-        distance = touzet.ted_k(t1_old, t2_old, dynamic_ted.k_old_);
-        stop = std::chrono::high_resolution_clock::now();
-        duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
-        std::cout << "Bounded Touzet: " << distance << " " << touzet.get_subproblem_count() << " " << duration << std::endl; // << normal_topdiff.td_.get_band_width() << std::endl;
-
-        start = std::chrono::high_resolution_clock::now();
-        distance = topdiff.ted(t1_old, t2_old);
-        stop = std::chrono::high_resolution_clock::now();
-        duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
-        std::cout << "Bound-Finding TopDiff: " << distance << " " << topdiff.get_subproblem_count() << " " << duration << std::endl; // << normal_topdiff.td_.get_band_width() << std::endl;
-
-        start = std::chrono::high_resolution_clock::now();
-        distance = touzet.ted(t1_old, t2_old);
-        stop = std::chrono::high_resolution_clock::now();
-        duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
-        std::cout << "Bound-Finding Touzet: " << distance << " " << touzet.get_subproblem_count() << " " << duration << std::endl; // << normal_topdiff.td_.get_band_width() << std::endl;
+        // a failed save leaves the last checkpoint in place, so the run carries on regardless
+        const auto now = std::chrono::steady_clock::now();
+        if ((checkpoint_steps > 0 && step - checkpoint_step >= checkpoint_steps)
+            || (checkpoint_seconds > 0 && std::chrono::duration<double>(now - checkpoint_time).count() >= checkpoint_seconds)) {
+            try {
+                ted::Checkpoint::save(checkpoint_path, dynamic_ted, *t1_old, *t2_old, labels);
+                std::cerr << "Checkpointed step " << step << std::endl;
+            }
+            catch (const std::runtime_error& error) {
+                std::cerr << error.what() << std::endl;
+            }
+            checkpoint_step = step;
+            checkpoint_time = now;
+        }
+
+        if (verify) {
+            // the previous step's references ran alongside this step
+            finish_verification();
+            std::shared_ptr<const update::TreeIndexIncremental> t1 = t1_old, t2 = t2_old;
+            auto snapshot_all = std::make_shared<const TreesAll>(reindex(*t1, *t2));
+            pending.emplace(Verification{step, distance, {}});
+            for (std::size_t reference = 0; reference < references.size(); ++reference) {
+                if (!references[reference]) continue;
+                pending->results[reference] = std::async(std::launch::async, [&run_reference, reference, t1, t2, snapshot_all, k = dynamic_ted.k_old_]() {
+                    return run_reference(reference, *t1, *t2, *snapshot_all, k);
+                });
+            }
+        }
+        else if (std::find(references.begin(), references.end(), true) != references.end()) {
+            const auto trees_all = reindex(*t1_old, *t2_old);
+            for (std::size_t reference = 0; reference < references.size(); ++reference) {
+                if (!references[reference]) continue;
+                auto result = run_reference(reference, *t1_old, *t2_old, trees_all, dynamic_ted.k_old_);
+                std::cout << reference_names[reference] << ": " << result.distance << " " << result.problems << " " << result.millis << std::endl;
+            }
+        }
     }
 
     return 0;
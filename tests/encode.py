@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+
+# The MIT License (MIT)
+# Copyright (c) 2022 Jonathan Stacey.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+# Writes the inputs the tests decode, encoded by bench.py itself, under the directory given:
+#   edits/<n>.old       a random tree, every label given
+#   edits/<n>.script    its next revision as the edit script bench.py --edit-scripts sends
+#   edits/<n>.bracket   the same revision as the bracket file bench.py sends otherwise
+#   edits/<n>.new       the same revision, every label given
+#   replays/<n>.replay  a run of two trees, as bench.py --record writes it
+#   replays/<n>.<s>.t1  tree 1 after step s of that run, every label given, step 0 being the baseline
+#   replays/<n>.<s>.t2  likewise for tree 2
+
+import os
+import random
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+sys.dont_write_bytecode = True
+
+from bench import Tree, chunk
+
+
+def full(node):
+    return "(" + node.label + "){" + "".join(map(full, node.children)) + "}"
+
+
+def files(node, path=()):
+    if not node.children and path:
+        yield path
+    for child in node.children:
+        yield from files(child, path + (child.label,))
+
+
+def revise(tree, rng, changes):
+    # additions and removals of files, as a commit makes them
+    for _ in range(changes):
+        paths = list(files(tree.root))
+        if paths and rng.random() < 0.4:
+            tree.remove(rng.choice(paths))
+        else:
+            tree.insert(tuple(rng.choice("abcdef") for _ in range(rng.randint(1, 4))))
+
+
+def write(path, data):
+    with open(path, "wb") as out:
+        out.write(data)
+
+
+def edits(out_dir, trees=40, revisions=5):
+    os.makedirs(out_dir, exist_ok=True)
+    n = 0
+    for seed in range(trees):
+        rng = random.Random(seed)
+        tree = Tree()
+        revise(tree, rng, rng.randint(1, 30))
+        for _ in range(revisions):
+            old = full(tree.root)
+            tree.setIndices()
+            revise(tree, rng, rng.randint(1, 4))
+            write(os.path.join(out_dir, "%d.old" % n), old.encode())
+            write(os.path.join(out_dir, "%d.script" % n), tree.edit_script())
+            write(os.path.join(out_dir, "%d.bracket" % n), str(tree).encode())
+            write(os.path.join(out_dir, "%d.new" % n), full(tree.root).encode())
+            n += 1
+
+
+def replays(out_dir, runs=20, steps=6):
+    os.makedirs(out_dir, exist_ok=True)
+    for n in range(runs):
+        rng = random.Random(n)
+        trees = [Tree(), Tree()]
+        for tree in trees:
+            revise(tree, rng, rng.randint(1, 20))
+        with open(os.path.join(out_dir, "%d.replay" % n), "wb") as out:
+            out.write(b"".join(chunk(str(tree).encode()) for tree in trees))
+            for step in range(steps + 1):
+                if step > 0:
+                    # either tree may be left unchanged by a step, as when it's fixed to one commit
+                    scripts = []
+                    for tree in trees:
+                        tree.setIndices()
+                        if rng.random() < 0.3:
+                            scripts.append(None)
+                        else:
+                            revise(tree, rng, rng.randint(1, 4))
+                            scripts.append(tree.edit_script())
+                    out.write(b"".join(map(chunk, scripts)))
+                for i, tree in enumerate(trees):
+                    write(os.path.join(out_dir, "%d.%d.t%d" % (n, step, i + 1)), full(tree.root).encode())
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        print("Usage: <output path>")
+        exit(1)
+
+    edits(os.path.join(sys.argv[1], "edits"))
+    replays(os.path.join(sys.argv[1], "replays"))
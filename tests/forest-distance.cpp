@@ -0,0 +1,144 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "check.hpp"
+#include "trees.hpp"
+
+#include "forest-distance.hpp"
+#include "string_label.h"
+
+#include "label_dictionary.h"
+#include "matrix.h"
+#include "touzet_baseline_tree_index.h"
+#include "unit_cost_model.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+using Label = label::StringLabel;
+
+label::LabelDictionary<Label> labels;
+parser::LabelInterner<Label> interner(labels);
+
+// unit costs, as a type UnitCost doesn't recognise, so that ForestDistance takes its generic kernel
+struct GenericUnitCost : cost_model::UnitCostModelLD<Label> {
+    using cost_model::UnitCostModelLD<Label>::UnitCostModelLD;
+};
+
+static_assert(ted::UnitCost<cost_model::UnitCostModelLD<Label>>::value && !ted::UnitCost<GenericUnitCost>::value);
+
+// a random tree of about size nodes, as bracket notation, over few labels so that renames are often free
+std::string random_tree(std::mt19937& rng, int size) {
+    std::string tree = "(" + std::string(1, "abc"[rng() % 3]) + "){";
+    while (--size > 0) {
+        const int child = std::min(size, static_cast<int>(rng() % 12) + 1);
+        tree += random_tree(rng, child);
+        size -= child - 1;
+    }
+    return tree + "}";
+}
+
+// Fills a band of td with each kernel, every pair in postorder as the engine does, and compares every cell,
+// the forest distances behind it and the subproblems counted. The unit cost kernel's rows are 8 wide under
+// AVX2, so budgets either side of that exercise both its vector and scalar columns.
+void kernels_agree() {
+    std::mt19937 rng(7);
+
+    for (int pair = 0; pair < 40; ++pair) {
+        const auto t1 = index(random_tree(rng, 20 + rng() % 60), interner);
+        const auto t2 = index(random_tree(rng, 20 + rng() % 60), interner);
+
+        for (const int k : {1, 3, 7, 8, 13, 30}) {
+
+            cost_model::UnitCostModelLD<Label> unit_model(labels);
+            GenericUnitCost generic_model(labels);
+            ted::ForestDistance<cost_model::UnitCostModelLD<Label>, update::TreeIndexIncremental> unit;
+            ted::ForestDistance<GenericUnitCost, update::TreeIndexIncremental> generic;
+            data_structures::BandMatrix<double> unit_td(t1.tree_size_, k), generic_td(t1.tree_size_, k);
+            long long int unit_subproblems = 0, generic_subproblems = 0;
+
+            int disagreements = 0;
+
+            for (int x = 0; x < t1.tree_size_; ++x) {
+                for (int y = std::max(0, x - k); y <= std::min(x + k, t2.tree_size_ - 1); ++y) {
+
+                    const int e = k - static_cast<int>(rng() % 3);
+                    unit_td.at(x, y) = unit(unit_model, t1, t2, unit_td, x, y, e, unit_subproblems);
+                    generic_td.at(x, y) = generic(generic_model, t1, t2, generic_td, x, y, e, generic_subproblems);
+
+                    disagreements += unit_td.at(x, y) != generic_td.at(x, y);
+                    for (int i = 0; i <= t1.postl_to_size_[x]; ++i) {
+                        for (int j = 0; j <= t2.postl_to_size_[y]; ++j) {
+                            // over budget, forest distances are only bounds, which the kernels may take differently
+                            const double expected = generic.forest(i, j);
+                            if (expected <= e) disagreements += unit.forest(i, j) != expected;
+                        }
+                    }
+                }
+            }
+
+            CHECK(disagreements == 0);
+            CHECK(unit_subproblems == generic_subproblems);
+        }
+    }
+}
+
+// the distance of a band swept with ForestDistance, widened as the Touzet engines widen theirs until it holds it
+template <typename Model>
+double swept_distance(const Model& model, const update::TreeIndexIncremental& t1, const update::TreeIndexIncremental& t2) {
+    ted::ForestDistance<Model, update::TreeIndexIncremental> kernel;
+    long long int subproblems = 0;
+
+    for (int k = std::abs(t1.tree_size_ - t2.tree_size_) + 1;; k *= 2) {
+        data_structures::BandMatrix<double> td(t1.tree_size_, k);
+        for (int x = 0; x < t1.tree_size_; ++x) {
+            for (int y = std::max(0, x - k); y <= std::min(x + k, t2.tree_size_ - 1); ++y) td.at(x, y) = kernel(model, t1, t2, td, x, y, k, subproblems);
+        }
+        const double distance = td.read_at(t1.tree_size_ - 1, t2.tree_size_ - 1);
+        if (distance <= k) return distance;
+    }
+}
+
+// both kernels find the distance the library's Touzet baseline, and so its tree_dist, does
+void kernels_match_touzet() {
+    std::mt19937 rng(11);
+
+    cost_model::UnitCostModelLD<Label> unit_model(labels);
+    GenericUnitCost generic_model(labels);
+    ted::TouzetBaselineTreeIndex<cost_model::UnitCostModelLD<Label>, update::TreeIndexIncremental> touzet(unit_model);
+
+    for (int pair = 0; pair < 60; ++pair) {
+        const auto t1 = index(random_tree(rng, 10 + rng() % 80), interner);
+        const auto t2 = index(random_tree(rng, 10 + rng() % 80), interner);
+
+        const double expected = touzet.ted(t1, t2);
+        CHECK(swept_distance(unit_model, t1, t2) == expected);
+        CHECK(swept_distance(generic_model, t1, t2) == expected);
+    }
+}
+
+int main() {
+    kernels_agree();
+    kernels_match_touzet();
+    return check::failures != 0;
+}
\ No newline at end of file
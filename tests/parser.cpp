@@ -0,0 +1,212 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "check.hpp"
+#include "trees.hpp"
+
+#include "parser.hpp"
+#include "tree-update.hpp"
+#include "string_label.h"
+
+#include "label_dictionary.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using Label = label::StringLabel;
+
+label::LabelDictionary<Label> labels;
+parser::LabelInterner<Label> interner(labels);
+
+// each revision bench.py writes (see tests/encode.py), read as its edit script and as its bracket file
+void edit_scripts_round_trip(const std::filesystem::path& data) {
+
+    int revisions = 0;
+
+    for (;; ++revisions) {
+        auto path = [&](const char* extension) { return (data / "edits" / (std::to_string(revisions) + extension)).string(); };
+        if (!std::filesystem::exists(path(".old"))) break;
+
+        parser::MappedFile old_file(path(".old")), script(path(".script")), bracket(path(".bracket")), new_file(path(".new"));
+        const auto t_old = index(old_file.view(), interner);
+        const auto expected = index(new_file.view(), interner);
+
+        update::TreeIndexIncremental from_script, from_bracket;
+        const auto script_preserved = update::apply(t_old, from_script, parser::parse_edits<Label>(script.view(), t_old.tree_size_), labels);
+        update::IndexBuilder builder(from_bracket);
+        const auto bracket_preserved = parser::parse_into(bracket.view(), builder, interner, t_old.prel_to_label_id_);
+
+        CHECK(same(from_script, expected));
+        CHECK(same(from_bracket, expected));
+        CHECK(script_preserved == bracket_preserved);
+
+        // a script cut short is rejected rather than read past its end
+        if (!script.view().empty()) {
+            bool threw = false;
+            try {
+                parser::parse_edits<Label>(script.view().substr(0, script.view().size() - 1), t_old.tree_size_);
+            }
+            catch (const std::runtime_error&) {
+                threw = true;
+            }
+            CHECK(threw);
+        }
+    }
+
+    CHECK(revisions > 0);
+}
+
+// each run bench.py records (see tests/encode.py), replayed from its baseline through every step
+void replays_round_trip(const std::filesystem::path& data) {
+
+    int runs = 0;
+
+    for (;; ++runs) {
+        auto path = [&](const std::string& suffix) { return (data / "replays" / (std::to_string(runs) + suffix)).string(); };
+        auto expected = [&](const size_t step, const int tree) {
+            parser::MappedFile file(path("." + std::to_string(step) + ".t" + std::to_string(tree)));
+            return index(file.view(), interner);
+        };
+        if (!std::filesystem::exists(path(".replay"))) break;
+
+        parser::MappedFile file(path(".replay"));
+        const auto replay = parser::parse_replay(file.view());
+
+        auto t1 = index(replay.t1, interner);
+        auto t2 = index(replay.t2, interner);
+        CHECK(same(t1, expected(0, 1)));
+        CHECK(same(t2, expected(0, 2)));
+        CHECK(!std::filesystem::exists(path("." + std::to_string(replay.steps.size() + 1) + ".t1")));
+
+        for (size_t step = 0; step < replay.steps.size(); ++step) {
+            for (auto [t, script] : {std::pair{&t1, replay.steps[step].first}, std::pair{&t2, replay.steps[step].second}}) {
+                if (!script) continue;
+                update::TreeIndexIncremental t_new;
+                update::apply(*t, t_new, parser::parse_edits<Label>(*script, t->tree_size_), labels);
+                std::swap(*t, t_new);
+            }
+            CHECK(same(t1, expected(step + 1, 1)));
+            CHECK(same(t2, expected(step + 1, 2)));
+        }
+
+        // a replay cut short is rejected rather than read past its end
+        bool threw = false;
+        try {
+            parser::parse_replay(file.view().substr(0, file.view().size() - 1));
+        }
+        catch (const std::runtime_error&) {
+            threw = true;
+        }
+        CHECK(threw);
+    }
+
+    CHECK(runs > 0);
+}
+
+// malformed bracket notation is reported with the byte offset it was found at, before the builder sees it
+void malformed_bracket_notation() {
+
+    const std::vector<int> old_prel_to_label_id = {interner.intern("a"), interner.intern("b")};
+
+    for (auto [source, message] : {
+        std::pair{"(a){}}", "'}' with no open node at byte 5"},
+        std::pair{"(a){(b){}}{}", "second root at byte 10"},
+        std::pair{"(a){{}}", "node with neither a label nor an index into the previous revision at byte 4"},
+        std::pair{"[0]{[2]{}}", "node index 2 beyond the previous revision at byte 7"},
+        std::pair{"[0]{(b{}}", "missing ')' at byte 4"},
+        std::pair{"[x]{}", "malformed node index at byte 1"},
+        std::pair{"[0]{[1x]{}}", "malformed node index at byte 5"},
+        std::pair{"(a){(b){}", "unterminated node at byte 9"},
+        std::pair{"", "no tree at byte 0"},
+    }) {
+        std::string error;
+        try {
+            update::TreeIndexIncremental t;
+            update::IndexBuilder builder(t);
+            parser::parse_into(source, builder, interner, old_prel_to_label_id);
+        }
+        catch (const std::runtime_error& e) {
+            error = e.what();
+        }
+        CHECK(error == message);
+    }
+}
+
+// an edit script addressing nodes the old tree doesn't have is reported with the byte offset of the node
+void malformed_edit_scripts() {
+
+    auto u32 = [](uint32_t value) { return std::string(reinterpret_cast<const char*>(&value), sizeof(value)); };
+
+    // old tree of 3 nodes
+    for (auto [script, message] : {
+        std::pair{"R" + u32(1) + u32(1) + "x" + "R" + u32(3) + u32(1) + "x", "node 3 beyond the previous revision at byte 11"},
+        std::pair{"D" + u32(7), "node 7 beyond the previous revision at byte 1"},
+        std::pair{"D" + u32(0), "deletion of the root at byte 1"},
+        std::pair{"I" + u32(3) + u32(0) + u32(1) + u32(1) + "x", "node 3 beyond the previous revision at byte 1"},
+        std::pair{"D" + u32(1) + "X", "unknown edit script operation at byte 5"},
+        std::pair{"D" + u32(1).substr(0, 2), "truncated edit script at byte 1"},
+    }) {
+        std::string error;
+        try {
+            parser::parse_edits<Label>(script, 3);
+        }
+        catch (const std::runtime_error& e) {
+            error = e.what();
+        }
+        CHECK(error == message);
+    }
+
+    // and edits built in memory are checked when they're applied
+    const auto t_old = index("(a){(b){}(c){}}", interner);
+    for (auto& edit : {
+        update::Edit<Label>(std::in_place_type<update::SubtreeDeletion>, 3),
+        update::Edit<Label>(std::in_place_type<update::SubtreeDeletion>, 0),
+        update::Edit<Label>(std::in_place_type<update::Relabel<Label>>, 5, Label("x")),
+    }) {
+        bool threw = false;
+        try {
+            update::TreeIndexIncremental t_new;
+            update::apply(t_old, t_new, std::vector<update::Edit<Label>>{edit}, labels);
+        }
+        catch (const std::runtime_error&) {
+            threw = true;
+        }
+        CHECK(threw);
+    }
+}
+
+int main(int argc, char* argv[]) {
+
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <test data path>" << std::endl;
+        return 1;
+    }
+
+    edit_scripts_round_trip(argv[1]);
+    replays_round_trip(argv[1]);
+    malformed_bracket_notation();
+    malformed_edit_scripts();
+    return check::failures != 0;
+}
\ No newline at end of file
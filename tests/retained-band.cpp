@@ -0,0 +1,175 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "check.hpp"
+
+#include "retained-band.hpp"
+#include "matrix.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+using Band = ted::AdaptiveRetainedBand<std::uint16_t, std::uint32_t>;
+
+// the distance Band holds for (x, y), or -1 if it holds none
+template <typename Retained>
+double retained_at(const Retained& band, const int x, const int y) {
+    return band.visit([&](const auto& held) {
+        using Held = std::remove_cvref_t<decltype(held)>;
+        if (y < held.first(x) || y > held.last(x) || *held.at(x, y) == Held::not_computed) return -1.0;
+        return static_cast<double>(*held.at(x, y));
+    });
+}
+
+// small problems are kept narrow
+void narrow_below_the_limit() {
+    data_structures::BandMatrix<double> td(3, 1);
+    td.at(0, 0) = 1;
+    td.at(1, 2) = 2;
+    td.at(2, 2) = 3;
+
+    Band band;
+    band.assign(td, 3, 3, 1);
+
+    CHECK(band.value_size() == sizeof(std::uint16_t));
+    CHECK(retained_at(band, 0, 0) == 1);
+    CHECK(retained_at(band, 1, 2) == 2);
+    CHECK(retained_at(band, 2, 2) == 3);
+    CHECK(retained_at(band, 2, 1) == -1);
+}
+
+// a problem whose distances may not fit in 16 bits is kept wide, rather than dropping or aliasing them
+void wide_above_the_limit() {
+    const int size = 40000;
+    data_structures::BandMatrix<double> td(size, 0);
+    td.at(size - 1, size - 1) = 70000;
+    td.at(size - 2, size - 2) = 65535;
+
+    Band band;
+    band.assign(td, size, size, 0);
+
+    CHECK(band.value_size() == sizeof(std::uint32_t));
+    CHECK(retained_at(band, size - 1, size - 1) == 70000);
+    CHECK(retained_at(band, size - 2, size - 2) == 65535);
+    CHECK(retained_at(band, 0, 0) == -1);
+
+    // and narrow again for the next small problem
+    band.clear(2);
+    CHECK(band.value_size() == sizeof(std::uint16_t));
+}
+
+// whether a and b hold the same cells for an n x n problem
+template <typename Retained>
+bool same_cells(const Retained& a, const Retained& b, const int n) {
+    for (int x = 0; x < n; ++x) {
+        for (int y = 0; y < n; ++y) {
+            if (retained_at(a, x, y) != retained_at(b, x, y)) return false;
+        }
+    }
+    return true;
+}
+
+// a band reads back from what save wrote, in place, whichever width it was kept in and however retain
+// narrowed it
+void save_load_round_trip() {
+    for (const int n : {6, 40000}) {
+        data_structures::BandMatrix<double> td(n, 2);
+        for (int x = 0; x < std::min(n, 6); ++x) {
+            for (int y = std::max(0, x - 2); y <= std::min(x + 2, n - 1); ++y) td.at(x, y) = x * 10 + y;
+        }
+
+        Band band;
+        band.assign(td, n, n, 2);
+
+        // drops old row 1 and old column 3
+        std::vector<int> rows(n), columns(n);
+        for (int i = 0; i < n; ++i) rows[i] = columns[i] = i;
+        rows[1] = columns[3] = -1;
+        band.retain(&rows, &columns);
+
+        std::ostringstream out;
+        out << "header";
+        band.save(out);
+        const auto saved = std::make_shared<const std::string>(out.str());
+
+        const char* const base = saved->data();
+        const char* const end = base + saved->size();
+
+        Band loaded;
+        CHECK(loaded.load(band.value_size(), n, n, base + 6, base, end, saved) == end);
+        CHECK(loaded.value_size() == band.value_size());
+        CHECK(same_cells(loaded, band, std::min(n, 8)));
+        CHECK(retained_at(loaded, 0, 0) == 0);
+        CHECK(retained_at(loaded, 1, 1) == -1);
+        CHECK(retained_at(loaded, 5, 3) == -1);
+        CHECK(retained_at(loaded, 5, 4) == 54);
+
+        // retain copies the spans it keeps out of the mapping, as it would compact them in place
+        rows[4] = columns[2] = -1;
+        Band reloaded;
+        reloaded.load(band.value_size(), n, n, base + 6, base, end, saved);
+        reloaded.retain(&rows, &columns);
+        band.retain(&rows, &columns);
+        CHECK(same_cells(reloaded, band, std::min(n, 8)));
+        CHECK(retained_at(reloaded, 4, 4) == -1);
+        CHECK(retained_at(reloaded, 5, 4) == 54);
+
+        // the second row's offset, pointing past the cells
+        auto corrupt = std::make_shared<std::string>(*saved);
+        const std::uint64_t offset = std::numeric_limits<std::uint32_t>::max();
+        std::memcpy(corrupt->data() + 6 + 8 + 16, &offset, sizeof(offset));
+
+        // and a band that's cut short, corrupt, or of other trees is rejected rather than read outside its cells
+        for (auto [data, rows, columns, cut] : {
+            std::tuple{saved, n, n, 1},
+            std::tuple{std::shared_ptr<const std::string>(corrupt), n, n, 0},
+            std::tuple{saved, n + 1, n, 0},
+            std::tuple{saved, n - 1, n, 0},
+            std::tuple{saved, n, n - 1, 0},
+        }) {
+            bool threw = false;
+            try {
+                Band rejected;
+                rejected.load(band.value_size(), rows, columns, data->data() + 6, data->data(), data->data() + data->size() - cut, data);
+            }
+            catch (const std::runtime_error&) {
+                threw = true;
+            }
+            CHECK(threw);
+        }
+    }
+}
+
+int main() {
+    narrow_below_the_limit();
+    wide_above_the_limit();
+    save_load_round_trip();
+    return check::failures != 0;
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#include "check.hpp"
+
+#include "revision-queue.hpp"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using Queue = ted::RevisionQueue<int>;
+
+// revisions still within the latency target are taken one at a time, oldest first
+void within_target_one_at_a_time() {
+    Queue queue(60 * 60 * 1000);
+    for (int revision = 0; revision < 3; ++revision) queue.push(revision);
+
+    CHECK(queue.take() == std::vector<int>{0});
+    CHECK(queue.take() == std::vector<int>{1});
+    CHECK(queue.take() == std::vector<int>{2});
+    CHECK(queue.taken == 3);
+    CHECK(queue.coalesced == 0);
+}
+
+// once the oldest has waited past the latency target, everything queued is taken together
+void behind_target_coalesced() {
+    Queue queue(0);
+    for (int revision = 0; revision < 3; ++revision) queue.push(revision);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+    CHECK(queue.take() == (std::vector<int>{0, 1, 2}));
+    CHECK(queue.taken == 3);
+    CHECK(queue.coalesced == 2);
+    CHECK(queue.waited_millis > 0);
+
+    // and a revision arriving afterwards starts a new take
+    queue.push(3);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    CHECK(queue.take() == std::vector<int>{3});
+    CHECK(queue.taken == 4);
+    CHECK(queue.coalesced == 2);
+}
+
+// take waits for a revision pushed from another thread, and is empty once closed and drained
+void blocks_until_pushed_or_closed() {
+    Queue queue(60 * 60 * 1000);
+    std::thread producer([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        queue.push(7);
+        queue.push(8);
+        queue.close();
+    });
+
+    CHECK(queue.take() == std::vector<int>{7});
+    CHECK(queue.take() == std::vector<int>{8});
+    CHECK(queue.take().empty());
+    CHECK(queue.take().empty());
+    producer.join();
+
+    CHECK(queue.taken == 2);
+    CHECK(queue.coalesced == 0);
+}
+
+int main() {
+    within_target_one_at_a_time();
+    behind_target_coalesced();
+    blocks_until_pushed_or_closed();
+    return check::failures != 0;
+}
\ No newline at end of file
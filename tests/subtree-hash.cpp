@@ -0,0 +1,103 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "check.hpp"
+#include "trees.hpp"
+
+#include "subtree-hash.hpp"
+#include "string_label.h"
+
+#include "label_dictionary.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+using Label = label::StringLabel;
+
+label::LabelDictionary<Label> labels;
+parser::LabelInterner<Label> interner(labels);
+
+constexpr int not_preserved = -1;
+
+// new postl -> old postl, as SubtreeMatcher finds them
+std::vector<int> match(std::string_view t_old, std::string_view t_new) {
+    const auto old_index = index(t_old, interner), new_index = index(t_new, interner);
+    ted::SubtreeMatcher<update::TreeIndexIncremental> matcher;
+    matcher.identical(old_index, new_index);
+    std::vector<int> preserved;
+    matcher.match(old_index, new_index, preserved, not_preserved);
+    return preserved;
+}
+
+void identical_trees() {
+    const auto t = index("(r){(a){(b){}}(c){}}", interner);
+    ted::SubtreeMatcher<update::TreeIndexIncremental> matcher;
+    CHECK(matcher.identical(t, t));
+    CHECK(!matcher.identical(t, index("(r){(a){(b){}}(d){}}", interner)));
+    CHECK(!matcher.identical(t, index("(r){(a){}(b){}(c){}}", interner)));
+}
+
+// a maximal subtree is matched whole, and a new root that differs is not
+void maximal_subtrees() {
+    CHECK(match("(r){(a){(b){}(c){}}(d){}}", "(s){(d){}(a){(b){}(c){}}}") == (std::vector<int>{3, 0, 1, 2, not_preserved}));
+}
+
+// of several identical old subtrees, the one closest by postl, below on a tie
+void closest_candidate() {
+    CHECK(match("(r){(a){}(b){}(a){}}", "(r){(b){}(a){}}") == (std::vector<int>{1, 0, not_preserved}));
+    CHECK(match("(r){(a){}(b){}(c){}(a){}}", "(r){(b){}(c){}(a){}}") == (std::vector<int>{1, 2, 3, not_preserved}));
+}
+
+// each old subtree is used once, and neither it nor its ancestors again
+void claimed_once() {
+    CHECK(match("(r){(a){}}", "(r){(a){}(a){}}") == (std::vector<int>{0, not_preserved, not_preserved}));
+    CHECK(match("(r){(x){(a){}}}", "(r){(a){}(x){(a){}}}") == (std::vector<int>{0, not_preserved, not_preserved, not_preserved}));
+}
+
+// Many identical leaves, shifted along by new ones before them: each new leaf passes over every old one
+// already claimed on its way to the closest free one, unless the claimed ones are dropped.
+void many_identical_leaves() {
+    const int leaves = 20000;
+    std::string t_old = "(r){", t_new = "(r){";
+    for (int leaf = 0; leaf < leaves; ++leaf) {
+        t_old += "(a){}";
+        t_new += "(b){}";
+    }
+    for (int leaf = 0; leaf < leaves; ++leaf) t_new += "(a){}";
+    t_old += "}";
+    t_new += "}";
+
+    const auto preserved = match(t_old, t_new);
+
+    std::vector<int> expected(2 * leaves + 1, not_preserved);
+    for (int leaf = 0; leaf < leaves; ++leaf) expected[leaves + leaf] = leaves - 1 - leaf;
+    CHECK(preserved == expected);
+}
+
+int main() {
+    identical_trees();
+    maximal_subtrees();
+    closest_candidate();
+    claimed_once();
+    many_identical_leaves();
+    return check::failures != 0;
+}
\ No newline at end of file
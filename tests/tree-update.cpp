@@ -0,0 +1,147 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "check.hpp"
+#include "trees.hpp"
+
+#include "parser.hpp"
+#include "tree-update.hpp"
+#include "string_label.h"
+
+#include "unit_cost_model.h"
+#include "tree_indexer.h"
+#include "label_dictionary.h"
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using Label = label::StringLabel;
+
+label::LabelDictionary<Label> labels;
+cost_model::UnitCostModelLD<Label> model(labels);
+parser::LabelInterner<Label> interner(labels);
+
+node::Node<Label> subtree(const std::string& label, std::vector<node::Node<Label>> children = {}) {
+    node::Node<Label> node{Label(label)};
+    for (auto& child : children) node.add_child(std::move(child));
+    return node;
+}
+
+// IndexBuilder fills the same components as node::index_tree
+void index_builder_matches_index_tree() {
+    for (std::string_view source : {"(a){}", "(a){(b){}(c){}}", "(a){(b){(d){}(e){(g){}}}(c){(f){}}}", "(a){(a){(a){(a){}}}(a){}}"}) {
+        update::NodeBuilder<Label> builder(labels);
+        parser::parse_into(source, builder, interner);
+        update::TreeIndexIncremental expected;
+        node::index_tree(expected, builder.tree(), labels, model);
+        CHECK(same(index(source, interner), expected));
+    }
+}
+
+// edits in any order, insertions sharing a position, and edits under a deleted subtree
+void apply_matches_fresh_parse() {
+
+    // prel: a 0, b 1, d 2, e 3, c 4, f 5
+    const auto t_old = index("(a){(b){(d){}(e){}}(c){(f){}}}", interner);
+
+    std::vector<update::Edit<Label>> edits;
+    edits.emplace_back(std::in_place_type<update::SubtreeInsertion<Label>>, 1, 1, subtree("y", {subtree("z")}));
+    edits.emplace_back(std::in_place_type<update::Relabel<Label>>, 3, Label("x"));
+    edits.emplace_back(std::in_place_type<update::SubtreeInsertion<Label>>, 4, 0, subtree("q"));
+    edits.emplace_back(std::in_place_type<update::SubtreeDeletion>, 4);
+    edits.emplace_back(std::in_place_type<update::Relabel<Label>>, 5, Label("r"));
+    edits.emplace_back(std::in_place_type<update::SubtreeInsertion<Label>>, 1, 1, subtree("w"));
+    edits.emplace_back(std::in_place_type<update::SubtreeInsertion<Label>>, 0, 0, subtree("v"));
+
+    // prel: a 0, v 1, b 2, d 3, y 4, z 5, w 6, x 7
+    const auto expected = index("(a){(v){}(b){(d){}(y){(z){}}(w){}(x){}}}", interner);
+    const std::unordered_map<size_t, size_t> expected_preserved = {{0, 0}, {2, 1}, {3, 2}, {7, 3}};
+
+    // t_new still holds a larger tree, whose storage apply reuses
+    auto t_new = index("(a){(b){(c){(d){(e){(f){(g){(h){(i){}}}}}}}}}", interner);
+    CHECK(update::apply(t_old, t_new, edits, labels) == expected_preserved);
+    CHECK(same(t_new, expected));
+
+    // the same edits streamed into a node::Node tree
+    update::NodeBuilder<Label> builder(labels);
+    CHECK(update::build(t_old, builder, edits, labels) == expected_preserved);
+    update::TreeIndexIncremental indexed;
+    node::index_tree(indexed, builder.tree(), labels, model);
+    CHECK(same(indexed, expected));
+
+    // no edits at all copies the tree, every node preserved
+    update::TreeIndexIncremental copy;
+    const auto preserved = update::apply(t_old, copy, std::vector<update::Edit<Label>>(), labels);
+    CHECK(same(copy, t_old));
+    CHECK(preserved.size() == static_cast<size_t>(t_old.tree_size_));
+    for (const auto& [new_prel, old_prel] : preserved) CHECK(new_prel == old_prel);
+}
+
+// the [index] markers of a revised bracket tree give the same tree and preserved nodes as the edits
+void parse_into_matches_apply() {
+
+    const auto t_old = index("(a){(b){(d){}(e){}}(c){(f){}}}", interner);
+
+    update::TreeIndexIncremental t_new;
+    update::IndexBuilder builder(t_new);
+    const auto preserved = parser::parse_into("[0]{(v){}[1]{[2]{}(y){(z){}}(w){}[3](x){}}}", builder, interner, t_old.prel_to_label_id_);
+
+    CHECK(same(t_new, index("(a){(v){}(b){(d){}(y){(z){}}(w){}(x){}}}", interner)));
+    CHECK(preserved == (std::unordered_map<size_t, size_t>{{0, 0}, {2, 1}, {3, 2}, {7, 3}}));
+}
+
+// two revisions' preserved nodes taken as one keep only the nodes both preserve
+void compose_keeps_nodes_preserved_by_both() {
+
+    // prel: a 0, b 1, c 2, d 3
+    const auto t0 = index("(a){(b){}(c){}(d){}}", interner);
+
+    // prel: a 0, x 1, b 2, d 3
+    std::vector<update::Edit<Label>> first;
+    first.emplace_back(std::in_place_type<update::SubtreeDeletion>, 2);
+    first.emplace_back(std::in_place_type<update::SubtreeInsertion<Label>>, 0, 0, subtree("x"));
+    update::TreeIndexIncremental t1;
+    const auto t0_to_t1 = update::apply(t0, t1, first, labels);
+    CHECK(t0_to_t1 == (std::unordered_map<size_t, size_t>{{0, 0}, {2, 1}, {3, 3}}));
+
+    // prel: a 0, x 1, e 2
+    std::vector<update::Edit<Label>> second;
+    second.emplace_back(std::in_place_type<update::SubtreeDeletion>, 2);
+    second.emplace_back(std::in_place_type<update::Relabel<Label>>, 3, Label("e"));
+    update::TreeIndexIncremental t2;
+    const auto t1_to_t2 = update::apply(t1, t2, second, labels);
+    CHECK(t1_to_t2 == (std::unordered_map<size_t, size_t>{{0, 0}, {1, 1}, {2, 3}}));
+
+    // x is new since t0, b is gone by t2, and a relabelled node is still the same node
+    CHECK(update::compose(t0_to_t1, t1_to_t2) == (std::unordered_map<size_t, size_t>{{0, 0}, {2, 3}}));
+    CHECK(update::compose(t0_to_t1, {}).empty());
+    CHECK(update::compose({}, t1_to_t2).empty());
+}
+
+int main() {
+    index_builder_matches_index_tree();
+    apply_matches_fresh_parse();
+    parse_into_matches_apply();
+    compose_keeps_nodes_preserved_by_both();
+    return check::failures != 0;
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+// The MIT License (MIT)
+// Copyright (c) 2022 Jonathan Stacey.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "parser.hpp"
+#include "tree-update.hpp"
+
+#include <string_view>
+
+// whether every component of two indexes is equal
+inline bool same(const update::TreeIndexIncremental& a, const update::TreeIndexIncremental& b) {
+    return a.tree_size_ == b.tree_size_
+        && a.prel_to_label_id_ == b.prel_to_label_id_
+        && a.postl_to_label_id_ == b.postl_to_label_id_
+        && a.prel_to_size_ == b.prel_to_size_
+        && a.postl_to_size_ == b.postl_to_size_
+        && a.prel_to_parent_ == b.prel_to_parent_
+        && a.postl_to_parent_ == b.postl_to_parent_
+        && a.postl_to_lld_ == b.postl_to_lld_
+        && a.postl_to_depth_ == b.postl_to_depth_
+        && a.prel_to_postl_ == b.prel_to_postl_
+        && a.postl_to_prel_ == b.postl_to_prel_
+        && a.postl_to_subtree_max_depth_ == b.postl_to_subtree_max_depth_;
+}
+
+// indexes a bracket notation tree with every label given
+template <typename Label>
+update::TreeIndexIncremental index(std::string_view source, parser::LabelInterner<Label>& interner) {
+    update::TreeIndexIncremental t;
+    update::IndexBuilder builder(t);
+    parser::parse_into(source, builder, interner);
+    return t;
+}
\ No newline at end of file